@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Allocator for std::vector that aligns the buffer, so simd loops can use aligned loads on it.
+template <typename T, size_t Alignment>
+struct AlignedAllocator
+{
+	using value_type = T;
+
+	template <typename U>
+	struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+	AlignedAllocator() = default;
+	template <typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+	T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment))); }
+	void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+	template <typename U>
+	bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+	template <typename U>
+	bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+// 64 bytes covers a cache line and an avx-512 register
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T, 64>>;
@@ -0,0 +1,44 @@
+#include "dfsph.h"
+#include "sph_kernels.h"
+#include <glm/gtx/norm.hpp>
+
+float calculateDfsphFactor(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, glm::vec3 boundaryGradient, const SPHSettings& settings)
+{
+	glm::vec3 gradientSum = boundaryGradient;
+	float gradientDotSum = 0;
+	withDensityKernel(settings, [&](auto kernel) {
+		forEachGradient(kernel, particles, i, neighbours, settings, [&](uint32_t j, glm::vec3 gradient) {
+			glm::vec3 weighted = particles.mass[j] * gradient;
+			gradientSum += weighted;
+			gradientDotSum += glm::dot(weighted, weighted);
+		});
+	});
+
+	float denominator = glm::dot(gradientSum, gradientSum) + gradientDotSum;
+	return denominator > 1e-6f ? particles.density[i] / denominator : 0;
+}
+
+float calculateDensityChange(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, glm::vec3 boundaryGradient, const SPHSettings& settings)
+{
+	glm::vec3 velocity = particles.getVelocity(i);
+	float densityChange = glm::dot(velocity, boundaryGradient);
+	withDensityKernel(settings, [&](auto kernel) {
+		forEachGradient(kernel, particles, i, neighbours, settings, [&](uint32_t j, glm::vec3 gradient) {
+			densityChange += particles.mass[j] * glm::dot(velocity - particles.getVelocity(j), gradient);
+		});
+	});
+	return densityChange;
+}
+
+glm::vec3 calculateDfsphVelocityCorrection(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const float* stiffness, glm::vec3 boundaryGradient,
+	const SPHSettings& settings)
+{
+	float stiffnessI = stiffness[i] / particles.density[i];
+	glm::vec3 correction = -stiffnessI * boundaryGradient;
+	withDensityKernel(settings, [&](auto kernel) {
+		forEachGradient(kernel, particles, i, neighbours, settings, [&](uint32_t j, glm::vec3 gradient) {
+			correction -= particles.mass[j] * (stiffnessI + stiffness[j] / particles.density[j]) * gradient;
+		});
+	});
+	return correction * settings.timeStep;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "sph.h"
+
+// Divergence-free SPH (Bender and Koschier 2015).
+// https://doi.org/10.1145/2786784.2786796
+// Two velocity solvers replace the pressure force. The divergence solver makes the velocity field divergence free
+// (Drho/Dt = 0) at the start of the step, the constant density solver then corrects the velocity after the non
+// pressure forces so the density predicted at the end of the step is the rest density. Both apply
+//   v_i -= dt * sum_j m_j (k_i / rho_i + k_j / rho_j) grad W_ij
+// with a stiffness k_i from the per particle factor alpha_i, which only depends on the positions and is computed once
+// per step. The stiffness of each solver is kept per particle (ParticleStore::densityStiffness and divergenceStiffness)
+// and half of it is applied up front the next step (warm start).
+// DFSPH works on the current positions, so the predicted positions are the positions in this mode.
+// boundaryGradient is the boundary's term of sum_j m_j grad W_ij (see HeightfieldBoundary), zero without one. The
+// boundary doesn't move and only takes the stiffness of i.
+
+// alpha_i = rho_i / (|sum_j m_j grad W_ij|^2 + sum_j |m_j grad W_ij|^2), 0 for a particle without neighbours
+float calculateDfsphFactor(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, glm::vec3 boundaryGradient, const SPHSettings& settings);
+
+// Drho/Dt = sum_j m_j (v_i - v_j) . grad W_ij
+float calculateDensityChange(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, glm::vec3 boundaryGradient, const SPHSettings& settings);
+
+// velocity change of i from the stiffnesses, indexed like particles
+glm::vec3 calculateDfsphVelocityCorrection(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const float* stiffness, glm::vec3 boundaryGradient,
+	const SPHSettings& settings);
@@ -8,40 +8,13 @@ Grid3D::Grid3D()
 
 }
 
-Grid3D::Grid3D(int width, int length, int height, float terrainSpacing, float cellSize, std::vector<SphParticle*> sphParticles, std::vector<TerrainParticle*> terrainParticles, Shader& shader)
-	:width(ceil(width / cellSize)), length(ceil(length / cellSize)), height(ceil(height / cellSize)), cellSize(cellSize * terrainSpacing), particleSearchRadius(cellSize * terrainSpacing), shader(shader)
+Grid3D::Grid3D(int width, int length, int height, float terrainSpacing, float cellSize, const ParticleStore& sphParticles, const std::vector<TerrainParticle*>& terrainParticles, Shader& shader, GridMode mode)
+	:width(ceil(width / cellSize)), length(ceil(length / cellSize)), height(ceil(height / cellSize)), cellSize(cellSize * terrainSpacing), particleSearchRadius(cellSize * terrainSpacing), shader(shader), mode(mode)
 {
-	cells = new Cell***[this->width];
-	for (int x = 0; x < this->width; x++)
-	{
-		cells[x] = new Cell**[this->height];
-		for (int y = 0; y < this->height; y++)
-		{
-			cells[x][y] = new Cell*[this->length];
-			for (int z = 0; z < this->length; z++)
-			{
-				cells[x][y][z] = new Cell(x,y,z, 
-					glm::vec3(
-						x - this->width / 2, 
-						y - this->height / 2, 
-						z - this->length / 2) * this->cellSize, this->cellSize, false, shader);
-			}
-		}
-	}
-
-	for (int i = 0; i < sphParticles.size(); i++)
-	{
-		Cell* cell = getCellFromPosition(sphParticles[i]->getPosition());
-		if (cell != nullptr)
-			cell->addSphParticle(sphParticles[i]);
-	}
-
-	for (int i = 0; i < terrainParticles.size(); i++)
-	{
-		Cell* cell = getCellFromPosition(terrainParticles[i]->getPosition());
-		if (cell != nullptr)
-			cell->addTerrainParticle(terrainParticles[i]);
-	}
+	if (mode == GridMode::DENSE)
+		createDenseCells(sphParticles, terrainParticles);
+	else
+		update(sphParticles, terrainParticles);
 
 	std::vector<Vertex> vertices = {
 
@@ -89,39 +62,471 @@ Grid3D::Grid3D(int width, int length, int height, float terrainSpacing, float ce
 	debugMesh = new Mesh(vertices, indices, shader);
 }
 
-void Grid3D::draw()
+void Grid3D::createDenseCells(const ParticleStore& sphParticles, const std::vector<TerrainParticle*>& terrainParticles)
+{
+	cells = new Cell***[this->width];
+	for (int x = 0; x < this->width; x++)
+	{
+		cells[x] = new Cell**[this->height];
+		for (int y = 0; y < this->height; y++)
+		{
+			cells[x][y] = new Cell*[this->length];
+			for (int z = 0; z < this->length; z++)
+			{
+				cells[x][y][z] = new Cell(x,y,z, 
+					glm::vec3(
+						x - this->width / 2, 
+						y - this->height / 2, 
+						z - this->length / 2) * this->cellSize, this->cellSize, false, shader);
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < sphParticles.size(); i++)
+	{
+		Cell* cell = getCellFromPosition(sphParticles.getPosition(i));
+		if (cell != nullptr)
+			cell->addSphParticle(i);
+	}
+
+	for (uint32_t i = 0; i < terrainParticles.size(); i++)
+	{
+		Cell* cell = getCellFromPosition(terrainParticles[i]->getPosition());
+		if (cell != nullptr)
+			cell->addTerrainParticle(i);
+	}
+}
+
+void Grid3D::getOccupiedCells(std::vector<uint64_t>& cellKeys) const
+{
+	cellKeys = sphCellList.cellKeys;
+}
+
+void Grid3D::draw(const std::vector<uint64_t>& occupiedCells)
 {
+	if (mode == GridMode::HASHED)
+	{
+		// only the occupied cells exist
+		for (size_t i = 0; i < occupiedCells.size(); i++)
+		{
+			int x, y, z;
+			unpackCellKey(occupiedCells[i], x, y, z);
+			drawCell(x, y, z);
+		}
+		return;
+	}
+
 	for (int x = 0; x < width; x++)
 	{
 		for (int y = 0; y < height; y++)
 		{
 			for (int z = 0; z < length; z++)
 			{
-				glm::mat4 model = glm::translate(glm::mat4(1.f), cells[x][y][z]->pos);
-				model = glm::scale(model, glm::vec3(cellSize));
-				shader.setMat4("model", model);
-				debugMesh->draw();
+				drawCell(x, y, z);
 			}
 		}
 	}
 }
 
-Cell* Grid3D::getCellFromPosition(glm::vec3 pos)
+void Grid3D::drawCell(int x, int y, int z)
+{
+	glm::vec3 pos = glm::vec3(x - width / 2, y - height / 2, z - length / 2) * cellSize;
+	glm::mat4 model = glm::translate(glm::mat4(1.f), pos);
+	model = glm::scale(model, glm::vec3(cellSize));
+	shader.setMat4("model", model);
+	debugMesh->draw();
+}
+
+void Grid3D::update(const ParticleStore& sphParticles, const std::vector<TerrainParticle*>& terrainParticles)
+{
+	updateSphParticles(sphParticles);
+	updateTerrainParticles(terrainParticles);
+}
+
+void Grid3D::updateSphParticles(const ParticleStore& sphParticles)
+{
+	if (mode == GridMode::DENSE) return;
+
+	// fluid particles move every step, so there is no point tracking which ones changed cell
+	auto positionOf = [&](uint32_t i) { return sphParticles.getPosition(i); };
+	if (mode == GridMode::HASHED)
+		rebuildHashedCellList(sphCellList, sphParticles.size(), positionOf);
+	else
+		rebuildCellList(sphCellList, sphParticles.size(), positionOf);
+}
+
+void Grid3D::updateTerrainParticles(const std::vector<TerrainParticle*>& terrainParticles)
+{
+	if (mode == GridMode::DENSE) return;
+
+	// terrain particles only need sorting again once erosion moved one into another cell
+	if (!terrainCellList.dirty) return;
+
+	auto positionOf = [&](uint32_t i) { return terrainParticles[i]->getPosition(); };
+	if (mode == GridMode::HASHED)
+		rebuildHashedCellList(terrainCellList, terrainParticles.size(), positionOf);
+	else
+		rebuildCellList(terrainCellList, terrainParticles.size(), positionOf);
+}
+
+void Grid3D::addSphParticle(const ParticleStore& sphParticles, uint32_t particle)
 {
-	float sizeX = width / cellSize;
-	float sizeY = height / cellSize;
-	float sizeZ = length / cellSize;
-	int x = ((pos.x / cellSize + (float)(width / 2)));
-	int y = ((pos.y / cellSize + (float)(height / 2)));
-	int z = ((pos.z / cellSize + (float)(length / 2)));
+	if (mode == GridMode::DENSE)
+	{
+		Cell* cell = getCellFromPosition(sphParticles.getPosition(particle));
+		if (cell != nullptr)
+			cell->addSphParticle(particle);
+		return;
+	}
+
+	sphCellList.dirty = true;
+}
+
+void Grid3D::moveSphParticle(const ParticleStore& sphParticles, uint32_t particle, glm::vec3 previousPosition)
+{
+	if (mode != GridMode::DENSE)
+	{
+		sphCellList.dirty = true;
+		return;
+	}
+
+	Cell* previousCell = getCellFromPosition(previousPosition);
+	Cell* currentCell = getCellFromPosition(sphParticles.getPosition(particle));
+	if (previousCell != currentCell)
+	{
+		if (previousCell != nullptr)
+			previousCell->removeSphParticle(particle);
+		if (currentCell != nullptr)
+			currentCell->addSphParticle(particle);
+	}
+}
 
-	if (x < 0 || x >= width || y < 0 || y >= height || z < 0 || z >= length) { 
+void Grid3D::reindexSphParticles(const ParticleStore& sphParticles)
+{
+	if (mode != GridMode::DENSE)
+	{
+		sphCellList.dirty = true;
+		return;
+	}
+
+	for (int x = 0; x < width; x++)
+		for (int y = 0; y < height; y++)
+			for (int z = 0; z < length; z++)
+				cells[x][y][z]->sphParticles.clear();
+
+	for (uint32_t i = 0; i < sphParticles.size(); i++)
+	{
+		Cell* cell = getCellFromPosition(sphParticles.getPosition(i));
+		if (cell != nullptr)
+			cell->addSphParticle(i);
+	}
+}
+
+void Grid3D::moveTerrainParticle(const std::vector<TerrainParticle*>& terrainParticles, uint32_t particle, glm::vec3 previousPosition)
+{
+	glm::vec3 position = terrainParticles[particle]->getPosition();
+	if (mode != GridMode::DENSE)
+	{
+		if (getCellKeyFromPosition(previousPosition) != getCellKeyFromPosition(position))
+			terrainCellList.dirty = true;
+		return;
+	}
+
+	Cell* previousCell = getCellFromPosition(previousPosition);
+	Cell* currentCell = getCellFromPosition(position);
+	if (previousCell != currentCell)
+	{
+		if (previousCell != nullptr)
+			previousCell->removeTerrainParticle(particle);
+		if (currentCell != nullptr)
+			currentCell->addTerrainParticle(particle);
+	}
+}
+
+void Grid3D::moveSphParticles(const std::vector<CellMigration>& migrations)
+{
+	if (migrations.empty()) return;
+	if (mode != GridMode::DENSE)
+	{
+		sphCellList.dirty = true;
+		return;
+	}
+
+	for (const CellMigration& migration : migrations)
+	{
+		Cell* previousCell = getCellFromPosition(migration.previousPosition);
+		Cell* currentCell = getCellFromPosition(migration.position);
+		if (previousCell == currentCell) continue;
+		if (previousCell != nullptr)
+			previousCell->removeSphParticle(migration.particle);
+		if (currentCell != nullptr)
+			currentCell->addSphParticle(migration.particle);
+	}
+}
+
+void Grid3D::moveTerrainParticles(const std::vector<CellMigration>& migrations)
+{
+	if (migrations.empty()) return;
+	if (mode != GridMode::DENSE)
+	{
+		terrainCellList.dirty = true;
+		return;
+	}
+
+	for (const CellMigration& migration : migrations)
+	{
+		Cell* previousCell = getCellFromPosition(migration.previousPosition);
+		Cell* currentCell = getCellFromPosition(migration.position);
+		if (previousCell == currentCell) continue;
+		if (previousCell != nullptr)
+			previousCell->removeTerrainParticle(migration.particle);
+		if (currentCell != nullptr)
+			currentCell->addTerrainParticle(migration.particle);
+	}
+}
+
+// truncated like the original dense grid, floored in hashed mode so cells stay the same size past the bounds
+bool Grid3D::getCellCoordinates(glm::vec3 pos, int& x, int& y, int& z) const
+{
+	if (mode == GridMode::HASHED)
+	{
+		x = (int)floorf(pos.x / cellSize + (float)(width / 2));
+		y = (int)floorf(pos.y / cellSize + (float)(height / 2));
+		z = (int)floorf(pos.z / cellSize + (float)(length / 2));
+		return true;
+	}
+
+	x = ((pos.x / cellSize + (float)(width / 2)));
+	y = ((pos.y / cellSize + (float)(height / 2)));
+	z = ((pos.z / cellSize + (float)(length / 2)));
+
+	return inBounds(x, y, z);
+}
+
+bool Grid3D::inBounds(int x, int y, int z) const
+{
+	if (mode == GridMode::HASHED) return true;
+	return !(x < 0 || x >= width || y < 0 || y >= height || z < 0 || z >= length);
+}
+
+Cell* Grid3D::getCellFromPosition(glm::vec3 pos)
+{
+	int x, y, z;
+	if (cells == nullptr || !getCellCoordinates(pos, x, y, z)) { 
 		// std::cout << "outside : " << x << ", " << y << ", " << z << std::endl;
 		return nullptr; }
 	
 	return cells[x][y][z];
 }
 
+int64_t Grid3D::getCellKeyFromPosition(glm::vec3 pos) const
+{
+	int x, y, z;
+	if (!getCellCoordinates(pos, x, y, z)) return -1;
+	if (mode == GridMode::HASHED) return packCellKey(x, y, z);
+	return getCellIndex(x, y, z);
+}
+
+// 21 bits per axis, biased so negative cells (outside of the nominal bounds) still pack
+const int CELL_KEY_BITS = 21;
+const int CELL_KEY_BIAS = 1 << (CELL_KEY_BITS - 1);
+const uint64_t CELL_KEY_MASK = (1ULL << CELL_KEY_BITS) - 1;
+
+uint64_t Grid3D::packCellKey(int x, int y, int z)
+{
+	return (((uint64_t)(x + CELL_KEY_BIAS) & CELL_KEY_MASK) << (2 * CELL_KEY_BITS)) |
+		(((uint64_t)(y + CELL_KEY_BIAS) & CELL_KEY_MASK) << CELL_KEY_BITS) |
+		((uint64_t)(z + CELL_KEY_BIAS) & CELL_KEY_MASK);
+}
+
+void Grid3D::unpackCellKey(uint64_t key, int& x, int& y, int& z)
+{
+	x = (int)((key >> (2 * CELL_KEY_BITS)) & CELL_KEY_MASK) - CELL_KEY_BIAS;
+	y = (int)((key >> CELL_KEY_BITS) & CELL_KEY_MASK) - CELL_KEY_BIAS;
+	z = (int)(key & CELL_KEY_MASK) - CELL_KEY_BIAS;
+}
+
+// spreads the low 21 bits so there are two zero bits between each of them
+static uint64_t spreadCellBits(uint64_t v)
+{
+	v &= CELL_KEY_MASK;
+	v = (v | v << 32) & 0x1f00000000ffffULL;
+	v = (v | v << 16) & 0x1f0000ff0000ffULL;
+	v = (v | v << 8) & 0x100f00f00f00f00fULL;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+	v = (v | v << 2) & 0x1249249249249249ULL;
+	return v;
+}
+
+// floored in every mode, particles outside of the bounds still get a key
+uint64_t Grid3D::getMortonKeyFromPosition(glm::vec3 pos) const
+{
+	int x = (int)floorf(pos.x / cellSize + (float)(width / 2));
+	int y = (int)floorf(pos.y / cellSize + (float)(height / 2));
+	int z = (int)floorf(pos.z / cellSize + (float)(length / 2));
+	return (spreadCellBits(x + CELL_KEY_BIAS) << 2) | (spreadCellBits(y + CELL_KEY_BIAS) << 1) | spreadCellBits(z + CELL_KEY_BIAS);
+}
+
+// counting sort on the linear cell key, particles outside the grid are left out like they are in dense mode
+template <typename PositionOf>
+void Grid3D::rebuildCellList(CellList& list, size_t count, PositionOf positionOf)
+{
+	size_t numCells = (size_t)width * height * length;
+	list.cellStart.assign(numCells + 1, 0);
+	sortKeys.resize(count);
+
+	uint32_t inside = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		sortKeys[i] = getCellKeyFromPosition(positionOf(i));
+		if (sortKeys[i] < 0) continue;
+		list.cellStart[sortKeys[i] + 1]++;
+		inside++;
+	}
+
+	for (size_t c = 0; c < numCells; c++)
+		list.cellStart[c + 1] += list.cellStart[c];
+
+	// scatter using the start of each cell as a write cursor, then shift the cursors back
+	list.particles.resize(inside);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (sortKeys[i] < 0) continue;
+		list.particles[list.cellStart[sortKeys[i]]++] = i;
+	}
+	for (size_t c = numCells; c > 0; c--)
+		list.cellStart[c] = list.cellStart[c - 1];
+	list.cellStart[0] = 0;
+
+	list.dirty = false;
+}
+
+// Same counting sort, over compact cell indices handed out as cells are first seen.
+// The table is sized from the particle count, which bounds the number of occupied cells.
+template <typename PositionOf>
+void Grid3D::rebuildHashedCellList(CellList& list, size_t count, PositionOf positionOf)
+{
+	size_t capacity = 16;
+	while (capacity < count * 2)
+		capacity *= 2;
+	list.table.assign(capacity, CellHashSlot{ 0, EMPTY_CELL_SLOT });
+	list.cellKeys.clear();
+	sortKeys.resize(count);
+
+	size_t mask = capacity - 1;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint64_t key = (uint64_t)getCellKeyFromPosition(positionOf(i));
+		size_t slot = CellList::hash(key) & mask;
+		while (list.table[slot].cell != EMPTY_CELL_SLOT && list.table[slot].key != key)
+			slot = (slot + 1) & mask;
+
+		if (list.table[slot].cell == EMPTY_CELL_SLOT)
+		{
+			list.table[slot] = CellHashSlot{ key, (uint32_t)list.cellKeys.size() };
+			list.cellKeys.push_back(key);
+		}
+		sortKeys[i] = list.table[slot].cell;
+	}
+
+	size_t numCells = list.cellKeys.size();
+	list.cellStart.assign(numCells + 1, 0);
+	for (uint32_t i = 0; i < count; i++)
+		list.cellStart[sortKeys[i] + 1]++;
+	for (size_t c = 0; c < numCells; c++)
+		list.cellStart[c + 1] += list.cellStart[c];
+
+	list.particles.resize(count);
+	for (uint32_t i = 0; i < count; i++)
+		list.particles[list.cellStart[sortKeys[i]]++] = i;
+	for (size_t c = numCells; c > 0; c--)
+		list.cellStart[c] = list.cellStart[c - 1];
+	list.cellStart[0] = 0;
+
+	list.dirty = false;
+}
+
+bool Grid3D::getCellRange(const CellList& list, int x, int y, int z, uint32_t& begin, uint32_t& end) const
+{
+	size_t cell;
+	if (mode == GridMode::HASHED)
+	{
+		if (list.table.empty()) return false;
+		uint32_t found = list.findCell(packCellKey(x, y, z));
+		if (found == EMPTY_CELL_SLOT) return false;
+		cell = found;
+	}
+	else
+	{
+		if (!inBounds(x, y, z)) return false;
+		cell = getCellIndex(x, y, z);
+	}
+
+	begin = list.cellStart[cell];
+	end = list.cellStart[cell + 1];
+	return true;
+}
+
+// same visiting order as the dense grid: current cell filtered by radius first, then the 26 neighbouring cells
+template <typename PositionOf>
+void Grid3D::gatherFromCellList(const CellList& list, PositionOf positionOf, glm::vec3 pos, uint32_t self, std::vector<uint32_t>& parts) const
+{
+	int cx, cy, cz;
+	if (!getCellCoordinates(pos, cx, cy, cz)) return;
+
+	float searchRadius2 = particleSearchRadius * particleSearchRadius;
+	uint32_t begin, end;
+	if (getCellRange(list, cx, cy, cz, begin, end))
+	{
+		for (uint32_t i = begin; i < end; i++)
+		{
+			if (list.particles[i] != self &&
+				glm::distance2(positionOf(list.particles[i]), pos) <= searchRadius2)
+				parts.push_back(list.particles[i]);
+		}
+	}
+
+	for (int x = -1; x <= 1; x++)
+	{
+		for (int y = -1; y <= 1; y++)
+		{
+			for (int z = -1; z <= 1; z++)
+			{
+				if (x == 0 && y == 0 && z == 0) continue;
+				if (!getCellRange(list, cx + x, cy + y, cz + z, begin, end)) continue;
+
+				parts.insert(parts.end(), list.particles.begin() + begin, list.particles.begin() + end);
+			}
+		}
+	}
+}
+
+template <typename PositionOf>
+void Grid3D::gatherFromDenseCells(std::vector<uint32_t> Cell::* cellParticles, PositionOf positionOf, glm::vec3 pos, uint32_t self, std::vector<uint32_t>& parts)
+{
+	Cell* current = getCellFromPosition(pos);
+	if (current == nullptr) return;
+	std::vector<Cell*> cells = getCellNeighbours(current);
+
+	float searchRadius2 = particleSearchRadius * particleSearchRadius;
+
+	// parts.insert(parts.end(), current->sphParticles.begin(), current->sphParticles.end());
+
+	const std::vector<uint32_t>& currentParticles = current->*cellParticles;
+	for (int i = 0; i < currentParticles.size(); i++)
+	{
+		if (currentParticles[i] != self &&
+			glm::distance2(positionOf(currentParticles[i]), pos) <= searchRadius2)
+			parts.push_back(currentParticles[i]);
+	}
+
+	for (int i = 0; i < cells.size(); i++)
+	{
+		const std::vector<uint32_t>& cellParts = cells[i]->*cellParticles;
+		parts.insert(parts.end(), cellParts.begin(), cellParts.end());
+	}
+}
+
 std::vector<Cell*> Grid3D::getCellNeighbours(Cell* cell)
 {
 	std::vector<Cell*> neighbours;
@@ -159,64 +564,70 @@ std::vector<Cell*> Grid3D::getCellNeighbours(Cell* cell)
 	return neighbours;
 }
 
-std::vector<SphParticle*> Grid3D::getNeighbouringSPHPaticlesInRadius(Particle* particle)
+std::vector<uint32_t> Grid3D::getNeighbouringSPHPaticlesInRadius(const ParticleStore& sphParticles, uint32_t particle)
 {
-	std::vector<SphParticle*> parts;
-	Cell* current = getCellFromPosition(particle->getPosition());
-	if (current == nullptr) return parts;
-	std::vector<Cell*> cells = getCellNeighbours(current);
-
-	float searchRadius2 = particleSearchRadius * particleSearchRadius;
-
-	// parts.insert(parts.end(), current->sphParticles.begin(), current->sphParticles.end());
-
-	for (int i = 0; i < current->sphParticles.size(); i++)
-	{
-		if (current->sphParticles[i]->getId() != particle->getId() &&
-			glm::distance2(current->sphParticles[i]->getPosition(), particle->getPosition()) <= searchRadius2)
-			parts.push_back(current->sphParticles[i]);
-	}
-
-	for (int i = 0; i < cells.size(); i++)
-	{
-		parts.insert(parts.end(), cells[i]->sphParticles.begin(), cells[i]->sphParticles.end());
-		//for (int j = 0; j < cells[i]->sphParticles.size(); j++)
-		//{
-		//	/*if(glm::distance2(particle->getPosition(), cells[i]->sphParticles[j]->getPosition()) <= searchRadius2)
-		//		parts.push_back(cells[i]->sphParticles[j]);*/
-		//}
-	}
+	std::vector<uint32_t> parts;
+	appendNeighbouringSPHPaticles(sphParticles, particle, parts);
 	return parts;
 }
 
-std::vector<TerrainParticle*> Grid3D::getNeighbouringTerrainPaticlesInRadius(Particle* particle)
+void Grid3D::appendNeighbouringSPHPaticles(const ParticleStore& sphParticles, uint32_t particle, std::vector<uint32_t>& parts)
 {
-	std::vector<TerrainParticle*> parts;
-	Cell* current = getCellFromPosition(particle->getPosition());
-	if (current == nullptr) return parts;
-	std::vector<Cell*> cells = getCellNeighbours(current);
+	auto positionOf = [&](uint32_t i) { return sphParticles.getPosition(i); };
+	if (mode == GridMode::DENSE)
+		gatherFromDenseCells(&Cell::sphParticles, positionOf, sphParticles.getPosition(particle), particle, parts);
+	else
+		gatherFromCellList(sphCellList, positionOf, sphParticles.getPosition(particle), particle, parts);
+}
 
-	float searchRadius2 = particleSearchRadius * particleSearchRadius;
+void Grid3D::appendNeighbouringTerrainPaticles(const std::vector<TerrainParticle*>& terrainParticles, glm::vec3 pos, std::vector<uint32_t>& parts)
+{
+	auto positionOf = [&](uint32_t i) { return terrainParticles[i]->getPosition(); };
+	if (mode == GridMode::DENSE)
+		gatherFromDenseCells(&Cell::terrainParticles, positionOf, pos, UINT32_MAX, parts);
+	else
+		gatherFromCellList(terrainCellList, positionOf, pos, UINT32_MAX, parts);
+}
 
-	// parts.insert(parts.end(), current->sphParticles.begin(), current->sphParticles.end());
+void Grid3D::appendSPHPaticlesInRadius(const ParticleStore& sphParticles, uint32_t particle, float radius, std::vector<uint32_t>& parts)
+{
+	glm::vec3 pos = sphParticles.getPosition(particle);
+	int cx, cy, cz;
+	if (!getCellCoordinates(pos, cx, cy, cz)) return;
 
-	for (int i = 0; i < current->terrainParticles.size(); i++)
-	{
-		if (current->terrainParticles[i]->getId() != particle->getId() &&
-			glm::distance2(current->terrainParticles[i]->getPosition(), particle->getPosition()) <= searchRadius2)
-			parts.push_back(current->terrainParticles[i]);
-	}
+	int reach = (int)ceil(radius / cellSize);
+	float radius2 = radius * radius;
 
-	for (int i = 0; i < cells.size(); i++)
+	for (int x = cx - reach; x <= cx + reach; x++)
 	{
-		parts.insert(parts.end(), cells[i]->terrainParticles.begin(), cells[i]->terrainParticles.end());
-		//for (int j = 0; j < cells[i]->sphParticles.size(); j++)
-		//{
-		//	/*if(glm::distance2(particle->getPosition(), cells[i]->sphParticles[j]->getPosition()) <= searchRadius2)
-		//		parts.push_back(cells[i]->sphParticles[j]);*/
-		//}
+		for (int y = cy - reach; y <= cy + reach; y++)
+		{
+			for (int z = cz - reach; z <= cz + reach; z++)
+			{
+				const uint32_t* begin;
+				const uint32_t* end;
+				if (mode == GridMode::DENSE)
+				{
+					if (!inBounds(x, y, z)) continue;
+					begin = cells[x][y][z]->sphParticles.data();
+					end = begin + cells[x][y][z]->sphParticles.size();
+				}
+				else
+				{
+					uint32_t first, last;
+					if (!getCellRange(sphCellList, x, y, z, first, last)) continue;
+					begin = sphCellList.particles.data() + first;
+					end = sphCellList.particles.data() + last;
+				}
+
+				for (const uint32_t* p = begin; p != end; p++)
+				{
+					if (*p != particle && glm::distance2(sphParticles.getPosition(*p), pos) <= radius2)
+						parts.push_back(*p);
+				}
+			}
+		}
 	}
-	return parts;
 }
 
 Cell::Cell(int x, int y, int z, glm::vec3 pos, float size, bool debug, Shader& shader)
@@ -224,7 +635,7 @@ Cell::Cell(int x, int y, int z, glm::vec3 pos, float size, bool debug, Shader& s
 {
 }
 
-void Cell::removeSphParticle(SphParticle* p)
+void Cell::removeSphParticle(uint32_t p)
 {
 	for (int i = 0; i < sphParticles.size(); i++)
 	{
@@ -235,12 +646,12 @@ void Cell::removeSphParticle(SphParticle* p)
 	}
 }
 
-void Cell::addSphParticle(SphParticle* p)
+void Cell::addSphParticle(uint32_t p)
 {
 	sphParticles.push_back(p);
 }
 
-void Cell::removeTerrainParticle(TerrainParticle* p)
+void Cell::removeTerrainParticle(uint32_t p)
 {
 	for (int i = 0; i < terrainParticles.size(); i++)
 	{
@@ -251,8 +662,7 @@ void Cell::removeTerrainParticle(TerrainParticle* p)
 	}
 }
 
-void Cell::addTerrainParticle(TerrainParticle* p)
+void Cell::addTerrainParticle(uint32_t p)
 {
 	terrainParticles.push_back(p);
 }
-
@@ -1,10 +1,24 @@
 #pragma once
 #include <vector>
+#include <cstdint>
 #include "shader/shader.h"
 #include "particle.h"
-#include "sph_particle.h"
+#include "particle_store.h"
 #include "terrain_particle.h"
 
+// DENSE keeps a heap allocated Cell per grid cell, updated incrementally as particles move.
+// CELL_LIST counting sorts the particles by linear cell key on every update, so the only
+// per cell storage is one offset into the sorted particle arrays.
+// HASHED sorts the same way, but only over occupied cells, found through a hash table on the 64 bit cell key.
+// Its memory follows the particle count instead of the domain volume, and particles outside of the
+// nominal bounds are still found by neighbour searches.
+enum class GridMode
+{
+	DENSE,
+	CELL_LIST,
+	HASHED,
+};
+
 class Cell
 {
 public:
@@ -13,34 +27,132 @@ public:
 	int x, y, z;
 	glm::vec3 pos;
 	float size;
-	void removeSphParticle(SphParticle* p);
-	void addSphParticle(SphParticle* p);
-	void removeTerrainParticle(TerrainParticle* p);
-	void addTerrainParticle(TerrainParticle* p);
-	std::vector<SphParticle*> sphParticles;
-	std::vector<TerrainParticle*> terrainParticles;
+	void removeSphParticle(uint32_t p);
+	void addSphParticle(uint32_t p);
+	void removeTerrainParticle(uint32_t p);
+	void addTerrainParticle(uint32_t p);
+	// indices into the particle store and the terrain particles
+	std::vector<uint32_t> sphParticles;
+	std::vector<uint32_t> terrainParticles;
 private:
 
 	Shader shader;
 	Mesh* debugMesh;
 };
 
+struct CellHashSlot
+{
+	uint64_t key;
+	uint32_t cell; // EMPTY_CELL_SLOT when unused
+};
+
+const uint32_t EMPTY_CELL_SLOT = UINT32_MAX;
+
+// a particle that moved into another cell, collected while the particles are updated in parallel
+// and handed to the grid in bulk after
+struct CellMigration
+{
+	uint32_t particle;
+	glm::vec3 previousPosition;
+	glm::vec3 position;
+};
+
+// Particle indices of one type sorted by cell, cell c holds particles[cellStart[c]] to particles[cellStart[c + 1]].
+// In hashed mode c is a compact index given to each occupied cell, looked up from the cell key with
+// open addressing (linear probing) in table.
+struct CellList
+{
+	std::vector<uint32_t> cellStart;
+	std::vector<uint32_t> particles;
+	bool dirty = true;
+
+	std::vector<CellHashSlot> table;
+	std::vector<uint64_t> cellKeys;
+
+	static size_t hash(uint64_t key)
+	{
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		return (size_t)key;
+	}
+
+	uint32_t findCell(uint64_t key) const
+	{
+		size_t mask = table.size() - 1;
+		for (size_t slot = hash(key) & mask; ; slot = (slot + 1) & mask)
+		{
+			if (table[slot].cell == EMPTY_CELL_SLOT) return EMPTY_CELL_SLOT;
+			if (table[slot].key == key) return table[slot].cell;
+		}
+	}
+};
+
+// Fluid particles are referred to by their index in the ParticleStore, terrain particles by their index in the
+// terrain particle vector. Both are passed in by the caller, the grid only keeps indices.
 class Grid3D
 {
 public:
 	Grid3D();
-	Grid3D(int width, int length, int height, float terrainSpacing, float cellSize, std::vector<SphParticle*> sphParticles, std::vector<TerrainParticle*> terrainParticles, Shader & shader);
-	void draw();
+	Grid3D(int width, int length, int height, float terrainSpacing, float cellSize, const ParticleStore& sphParticles, const std::vector<TerrainParticle*>& terrainParticles, Shader & shader, GridMode mode);
+	// occupiedCells is only used in hashed mode, from getOccupiedCells, so the grid can be drawn while it is updated
+	void draw(const std::vector<uint64_t>& occupiedCells);
+	void getOccupiedCells(std::vector<uint64_t>& cellKeys) const;
+	// rebuilds the cell lists, does nothing in dense mode where the cells are kept up to date as particles move.
+	void update(const ParticleStore& sphParticles, const std::vector<TerrainParticle*>& terrainParticles);
+	void updateSphParticles(const ParticleStore& sphParticles);
+	void updateTerrainParticles(const std::vector<TerrainParticle*>& terrainParticles);
+	void addSphParticle(const ParticleStore& sphParticles, uint32_t particle);
+	void moveSphParticle(const ParticleStore& sphParticles, uint32_t particle, glm::vec3 previousPosition);
+	// call after the particle store was reordered, the dense cells still hold the old indices
+	void reindexSphParticles(const ParticleStore& sphParticles);
+	void moveTerrainParticle(const std::vector<TerrainParticle*>& terrainParticles, uint32_t particle, glm::vec3 previousPosition);
+	// applied in order, so a particle can appear more than once
+	void moveSphParticles(const std::vector<CellMigration>& migrations);
+	void moveTerrainParticles(const std::vector<CellMigration>& migrations);
+	// always nullptr in cell list mode
 	Cell* getCellFromPosition(glm::vec3 pos);
+	// linear cell index (or packed cell key in hashed mode), -1 outside of the grid
+	int64_t getCellKeyFromPosition(glm::vec3 pos) const;
+	// interleaved cell coordinates, sorting by it keeps particles of nearby cells close in memory
+	uint64_t getMortonKeyFromPosition(glm::vec3 pos) const;
 	std::vector<Cell*> getCellNeighbours(Cell* cell);
-	std::vector<SphParticle*> getNeighbouringSPHPaticlesInRadius(Particle* particle);
-	std::vector<TerrainParticle*> getNeighbouringTerrainPaticlesInRadius(Particle* particle);
-	Cell**** cells;
+	std::vector<uint32_t> getNeighbouringSPHPaticlesInRadius(const ParticleStore& sphParticles, uint32_t particle);
+	// same as above, but appends to an existing vector so the per step neighbour lists don't allocate
+	void appendNeighbouringSPHPaticles(const ParticleStore& sphParticles, uint32_t particle, std::vector<uint32_t>& parts);
+	void appendNeighbouringTerrainPaticles(const std::vector<TerrainParticle*>& terrainParticles, glm::vec3 pos, std::vector<uint32_t>& parts);
+	// every other particle within radius, searching as many cells out as the radius needs (used by the verlet lists)
+	void appendSPHPaticlesInRadius(const ParticleStore& sphParticles, uint32_t particle, float radius, std::vector<uint32_t>& parts);
+	GridMode getMode() const { return mode; }
+	Cell**** cells = nullptr;
 	float cellSize;
 private:
+	void createDenseCells(const ParticleStore& sphParticles, const std::vector<TerrainParticle*>& terrainParticles);
+	bool getCellCoordinates(glm::vec3 pos, int& x, int& y, int& z) const;
+	bool inBounds(int x, int y, int z) const;
+	size_t getCellIndex(int x, int y, int z) const { return ((size_t)x * height + y) * length + z; }
+	static uint64_t packCellKey(int x, int y, int z);
+	static void unpackCellKey(uint64_t key, int& x, int& y, int& z);
+
+	template <typename PositionOf>
+	void rebuildCellList(CellList& list, size_t count, PositionOf positionOf);
+	template <typename PositionOf>
+	void rebuildHashedCellList(CellList& list, size_t count, PositionOf positionOf);
+	bool getCellRange(const CellList& list, int x, int y, int z, uint32_t& begin, uint32_t& end) const;
+	// self is skipped in the current cell, pass UINT32_MAX when searching for particles of another type
+	template <typename PositionOf>
+	void gatherFromCellList(const CellList& list, PositionOf positionOf, glm::vec3 pos, uint32_t self, std::vector<uint32_t>& parts) const;
+	template <typename PositionOf>
+	void gatherFromDenseCells(std::vector<uint32_t> Cell::* cellParticles, PositionOf positionOf, glm::vec3 pos, uint32_t self, std::vector<uint32_t>& parts);
+	void drawCell(int x, int y, int z);
+
+	GridMode mode = GridMode::DENSE;
+	CellList sphCellList;
+	CellList terrainCellList;
+	std::vector<int64_t> sortKeys;
+
 	Shader shader;
 	float particleSearchRadius;
 	int width, length, height;
 	Mesh* debugMesh;
 };
-
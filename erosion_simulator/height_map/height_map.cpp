@@ -50,10 +50,7 @@ void HeightMap::loadHeightMapFromFile(std::string fileName)
 	this->length = height;
 	offset = glm::vec2(width / 2, height / 2);
 
-	heightMap = new float* [width];
-	for (int i = 0; i < width; i++) {
-		heightMap[i] = new float[height];
-	}
+	heights.resize(width, height);
 
 	for (int y = 0; y < height; y++)
 	{
@@ -62,7 +59,7 @@ void HeightMap::loadHeightMapFromFile(std::string fileName)
 			const stbi_uc* p = img + (y * height + x);
 
 			float h = p[0] / 255.0f * maxHeight;
-			heightMap[x][y] = h;
+			heights.at(x, y) = h;
 		}
 	}
 
@@ -121,16 +118,13 @@ void HeightMap::loadHeightMapFromOBJFile(std::string fileName, float heightDiff)
 	this->width = width;
 	this->length = length;
 
-	heightMap = new float* [width];
-	for (int i = 0; i < width; i++) {
-		heightMap[i] = new float[length];
-	}
+	heights.resize(width, length);
 
 	for (int y = 0; y < length; y++)
 	{
 		for (int x = 0; x < width; x++)
 		{
-			heightMap[x][y] = vertices[y * width + x].y * 256.0 + (float)x / (width / heightDiff);
+			heights.at(x, y) = vertices[y * width + x].y * 256.0 + (float)x / (width / heightDiff);
 		}
 	}
 }
@@ -152,8 +146,8 @@ void HeightMap::printMap()
 {
 	for (int y = 0; y < length; y++) {
 		for (int x = 0; x < width; x++) {
-			if (heightMap[x][y] > 0)
-				std::cout << heightMap[x][y] << " ";
+			if (heights.at(x, y) > 0)
+				std::cout << heights.at(x, y) << " ";
 			else
 				std::cout << "." << " ";
 		}
@@ -179,13 +173,13 @@ void HeightMap::saveHeightMapPPM(std::string fileName)
 	buffer.clear();
 }
 
-void HeightMap::saveHeightMapPPM(std::string fileName, float*** hmp)
+void HeightMap::saveHeightMapPPM(std::string fileName, const Heightfield& hmp)
 {
 	std::vector<double> buffer(3 * width * length);
 
 	for (int y = 0; y < length; y++) {
 		for (int x = 0; x < width; x++) {
-			double color = std::clamp((double)(*hmp[x][y] + minHeight) / (double)(maxHeight + minHeight), 0.0, 1.0);
+			double color = std::clamp((double)(hmp.at(x, y) + minHeight) / (double)(maxHeight + minHeight), 0.0, 1.0);
 			buffer[3 * y * width + 3 * x + 0] = color;
 			buffer[3 * y * width + 3 * x + 1] = color;
 			buffer[3 * y * width + 3 * x + 2] = color;
@@ -209,15 +203,12 @@ void HeightMap::generateHeightMap()
 
 	int size = width;
 
-	heightMap = new float* [size];
-	for (int i = 0; i < size; i++) {
-		heightMap[i] = new float[size];
-	}
+	heights.resize(size, size);
 
-	float num1 = heightMap[0][0] = (float)heightDistr(mapGenerator);
-	float num2 = heightMap[size - 1][0] = (float)heightDistr(mapGenerator);
-	float num3 = heightMap[0][size - 1] = (float)heightDistr(mapGenerator);
-	float num4 = heightMap[size - 1][size - 1] = (float)heightDistr(mapGenerator);
+	float num1 = heights.at(0, 0) = (float)heightDistr(mapGenerator);
+	float num2 = heights.at(size - 1, 0) = (float)heightDistr(mapGenerator);
+	float num3 = heights.at(0, size - 1) = (float)heightDistr(mapGenerator);
+	float num4 = heights.at(size - 1, size - 1) = (float)heightDistr(mapGenerator);
 
 	int chunkSize = size - 1;
 	float roughness = random;
@@ -238,11 +229,6 @@ void HeightMap::regenerateHeightMap()
 	if (width != length)
 		throw std::exception("Width and Lenght of the heightmap do not match");
 
-	int size = width;
-	for (int i = 0; i < size; i++) {
-		delete heightMap[i];
-	}
-	delete heightMap;
 	generateHeightMap();
 }
 
@@ -256,9 +242,9 @@ void HeightMap::squareStep(int chunkSize, int halfChunkSize)
 	{
 		for (int y = 0; y < size - 1; y += chunkSize)
 		{
-			double avg = heightMap[x][y] + heightMap[x + chunkSize][y] + heightMap[x][y + chunkSize] + heightMap[x + chunkSize][y + chunkSize];
+			double avg = heights.at(x, y) + heights.at(x + chunkSize, y) + heights.at(x, y + chunkSize) + heights.at(x + chunkSize, y + chunkSize);
 			avg /= 4.0;
-			heightMap[x + halfChunkSize][y + halfChunkSize] = avg + randomDistr(mapGenerator);
+			heights.at(x + halfChunkSize, y + halfChunkSize) = avg + randomDistr(mapGenerator);
 		}
 	}
 }
@@ -273,15 +259,15 @@ void HeightMap::diamondStep(int chunkSize, int halfChunkSize)
 	{
 		for (int y = (x + halfChunkSize) % chunkSize; y < size - 1; y += chunkSize)
 		{
-			double avg = heightMap[(x - halfChunkSize + size - 1) % (size - 1)][y] +
-				heightMap[(x + halfChunkSize) % (size - 1)][y] +
-				heightMap[x][(y + halfChunkSize) % (size - 1)] +
-				heightMap[x][(y - halfChunkSize + size - 1) % (size - 1)];
+			double avg = heights.at((x - halfChunkSize + size - 1) % (size - 1), y) +
+				heights.at((x + halfChunkSize) % (size - 1), y) +
+				heights.at(x, (y + halfChunkSize) % (size - 1)) +
+				heights.at(x, (y - halfChunkSize + size - 1) % (size - 1));
 			avg /= 4.0 + randomDistr(mapGenerator);
-			heightMap[x][y] = avg;
+			heights.at(x, y) = avg;
 
-			if (x == 0) heightMap[size - 1][y] = avg;
-			if (y == 0) heightMap[x][size - 1] = avg;
+			if (x == 0) heights.at(size - 1, y) = avg;
+			if (y == 0) heights.at(x, size - 1) = avg;
 		}
 	}
 }
\ No newline at end of file
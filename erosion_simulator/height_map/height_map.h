@@ -2,6 +2,7 @@
 #include <random>
 #include <string>
 #include "glm/glm.hpp"
+#include "heightfield.h"
 
 class HeightMap
 {
@@ -13,16 +14,16 @@ public:
 	void loadHeightMapFromOBJFile(std::string, float heightDiff);
 	void setHeightRange(float minHeight, float maxHeight);
 	void setRandomRange(float random);
-	float** getHeightMap() const { return heightMap; }
+	const Heightfield& getHeightfield() const { return heights; }
 	int getWidth() const { return width; }
 	int getLength() const { return length; }
 	void printMap();
 	void changeSeed() {mapGenerator.seed(seedDistr(seedGenerator)); regenerateHeightMap(); }
 	void saveHeightMapPPM(std::string fileName);
-	void saveHeightMapPPM(std::string fileName, float*** hmp);
-	glm::vec3 getPositionAtIndex(int x, int y) const { return glm::vec3(x - offset.x, heightMap[x][y], y - offset.y); }
-	float sampleHeightAtIndex(int x, int y) const { return heightMap[x][y]; }
-	float getRGBA(int x, int y) const { return std::clamp(heightMap[x][y] + minHeight / maxHeight + minHeight, 0.0f, 1.0f); }
+	void saveHeightMapPPM(std::string fileName, const Heightfield& hmp);
+	glm::vec3 getPositionAtIndex(int x, int y) const { return glm::vec3(x - offset.x, heights.at(x, y), y - offset.y); }
+	float sampleHeightAtIndex(int x, int y) const { return heights.at(x, y); }
+	float getRGBA(int x, int y) const { return std::clamp(heights.at(x, y) + minHeight / maxHeight + minHeight, 0.0f, 1.0f); }
 	int getMaxHeight() const { return maxHeight; }
 	int getMinHeight() const { return minHeight; }
 	float getMinX() const { return - offset.x; }
@@ -33,8 +34,6 @@ public:
 	bool pointInBounds(float x, float z) const;
 	glm::vec2 getOffset() const { return offset; }
 
-	float** heightMap;
-
 private:
 	void generateHeightMap();
 	void regenerateHeightMap();
@@ -42,6 +41,7 @@ private:
 	void diamondStep(int chunkSize, int halfChunkSize);
 
 
+	Heightfield heights;
 	int width;
 	int length;
 
@@ -0,0 +1,56 @@
+#include "heightfield.h"
+#include <algorithm>
+
+Heightfield::Heightfield(int width, int length)
+{
+	resize(width, length);
+}
+
+void Heightfield::resize(int newWidth, int newLength)
+{
+	width = newWidth;
+	length = newLength;
+	tilesX = (width + tileSize - 1) / tileSize;
+	tilesY = (length + tileSize - 1) / tileSize;
+	heights.assign((size_t)width * length, 0.0f);
+	originalHeights.clear();
+	tileVersions.assign(tilesX * tilesY, 0);
+}
+
+void Heightfield::copyChangedTiles(const Heightfield& other, std::vector<uint32_t>& copied)
+{
+	if (other.width != width || other.length != length)
+	{
+		resize(other.width, other.length);
+		heights = other.heights;
+		tileVersions = other.tileVersions;
+		for (uint32_t tile = 0; tile < (uint32_t)getTileCount(); tile++)
+			copied.push_back(tile);
+		return;
+	}
+
+	for (uint32_t tile = 0; tile < (uint32_t)getTileCount(); tile++)
+	{
+		if (tileVersions[tile] == other.tileVersions[tile]) continue;
+		tileVersions[tile] = other.tileVersions[tile];
+		copied.push_back(tile);
+
+		int x0, y0, x1, y1;
+		getTileBounds(tile, x0, y0, x1, y1);
+		for (int y = y0; y < y1; y++)
+			std::copy(other.heights.begin() + y * width + x0, other.heights.begin() + y * width + x1, heights.begin() + y * width + x0);
+	}
+}
+
+void Heightfield::getTileBounds(uint32_t tile, int& x0, int& y0, int& x1, int& y1) const
+{
+	x0 = (tile % tilesX) * tileSize;
+	y0 = (tile / tilesX) * tileSize;
+	x1 = std::min(x0 + tileSize, width);
+	y1 = std::min(y0 + tileSize, length);
+}
+
+void Heightfield::storeOriginal()
+{
+	originalHeights = heights;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "glm/glm.hpp"
+#include "aligned_allocator.h"
+
+// Terrain heights, one float per vertex in one aligned row-major buffer: vertex (x, y) is at y * width + x.
+// HeightMap generates into one, and every TerrainMesh keeps its own copy (the simulation and the render thread
+// each have a mesh) that the erosion, the collision and the render vertices all work from.
+// Changes are tracked per tile of tileSize x tileSize vertices: every change bumps the version of its tile, and a copy
+// only takes the tiles whose version differs. Versions rather than dirty flags, so a copy that is skipped (a frame the
+// render thread never picked up) isn't lost, the next one still sees the difference.
+class Heightfield
+{
+public:
+	static const int tileSize = 32;
+
+	Heightfield() {}
+	Heightfield(int width, int length);
+
+	// drops the original heights
+	void resize(int width, int length);
+	// the heights of the tiles that changed since the last copy from other (or all of them when the size differs),
+	// not the original ones. the indices of the copied tiles are appended to copied
+	void copyChangedTiles(const Heightfield& other, std::vector<uint32_t>& copied);
+
+	int getTilesX() const { return tilesX; }
+	int getTilesY() const { return tilesY; }
+	int getTileCount() const { return tilesX * tilesY; }
+	// the vertices [x0, x1) x [y0, y1) of the tile
+	void getTileBounds(uint32_t tile, int& x0, int& y0, int& x1, int& y1) const;
+	uint32_t getTileOfVertex(size_t vertex) const { return (uint32_t)((vertex / width / tileSize) * tilesX + (vertex % width) / tileSize); }
+	// call after changing the height of the vertex. not thread safe within a tile
+	void markChanged(size_t vertex) { tileVersions[getTileOfVertex(vertex)]++; }
+	int getWidth() const { return width; }
+	int getLength() const { return length; }
+	size_t size() const { return heights.size(); }
+
+	float& at(int x, int y) { return heights[y * width + x]; }
+	float at(int x, int y) const { return heights[y * width + x]; }
+	float& operator[](size_t i) { return heights[i]; }
+	float operator[](size_t i) const { return heights[i]; }
+	float* data() { return heights.data(); }
+	const float* data() const { return heights.data(); }
+
+	// keeps a copy of the current heights, what the terrain shader shows the erosion against
+	void storeOriginal();
+	bool hasOriginal() const { return !originalHeights.empty(); }
+	float getOriginal(size_t i) const { return originalHeights[i]; }
+	const float* getOriginalData() const { return originalHeights.data(); }
+
+private:
+	int width = 0, length = 0;
+	int tilesX = 0, tilesY = 0;
+	AlignedVector<float> heights;
+	AlignedVector<float> originalHeights;
+	std::vector<uint32_t> tileVersions;
+};
+
+// the heights of a Heightfield and where it sits in the world, what the collision and the heightfield boundary read
+struct HeightfieldView
+{
+	const float* heights = nullptr;
+	int width = 0, length = 0;
+	// added to a world x and z to get the vertex coordinates
+	glm::vec2 offset = glm::vec2(0);
+};
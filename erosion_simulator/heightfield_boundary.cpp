@@ -0,0 +1,74 @@
+#include "heightfield_boundary.h"
+#include "sph_kernels.h"
+#include <algorithm>
+
+// with r the distance to the particle and z the depth of the slice, the kernel over the plane at depth z is
+//   A(z) = 2 pi int_z^h W(r) r dr
+// and the tables are volume(d) = int_d^h A(z) dz, gradient(d) = -A(d) and
+//   pressure(d) = int_d^h 2 pi z int_z^h W(r) dr dz
+// all integrated from h down with the trapezoid rule
+template <typename Kernel>
+static void buildTables(Kernel, const SPHSettings& settings, int size, std::vector<float>& volumes, std::vector<float>& gradients, std::vector<float>& pressures)
+{
+	float step = settings.h / size;
+	volumes.assign(size + 1, 0);
+	gradients.assign(size + 1, 0);
+	pressures.assign(size + 1, 0);
+
+	float weightedSum = 0, sum = 0;
+	float previousW = 0, previousArea = 0, previousSlice = 0;
+	for (int k = size; k >= 0; k--)
+	{
+		float r = k * step;
+		float w = Kernel::value(settings, r, r * r);
+		if (k < size)
+		{
+			weightedSum += 0.5f * step * (w * r + previousW * (r + step));
+			sum += 0.5f * step * (w + previousW);
+		}
+		float area = 2 * pi * weightedSum;
+		float slice = 2 * pi * r * sum;
+		if (k < size)
+		{
+			volumes[k] = volumes[k + 1] + 0.5f * step * (area + previousArea);
+			pressures[k] = pressures[k + 1] + 0.5f * step * (slice + previousSlice);
+		}
+		gradients[k] = -area;
+		previousW = w;
+		previousArea = area;
+		previousSlice = slice;
+	}
+}
+
+void HeightfieldBoundary::update(const SPHSettings& settings)
+{
+	if (h == settings.h && kernel == settings.densityKernel && !volumes.empty())
+		return;
+	h = settings.h;
+	kernel = settings.densityKernel;
+	withDensityKernel(settings, [&](auto densityKernel) {
+		buildTables(densityKernel, settings, tableSize, volumes, gradients, pressures);
+	});
+}
+
+// further than h the boundary only needs the distance, the normal is left pointing up
+void HeightfieldBoundary::sample(const HeightfieldView& terrain, glm::vec3 position, BoundarySample& sample) const
+{
+	glm::vec3 normal;
+	float height = sampleTerrain(terrain, position.x, position.z, normal);
+	sample.distance = position.y - height;
+	sample.normal = glm::vec3(0, 1, 0);
+	if (sample.distance >= h) return;
+
+	sample.normal = normal;
+	sample.distance *= sample.normal.y;
+}
+
+float HeightfieldBoundary::lookup(const std::vector<float>& table, float distance) const
+{
+	if (distance >= h) return 0;
+	float x = std::max(0.0f, distance) / h * tableSize;
+	int k = std::min((int)x, tableSize - 1);
+	float t = x - k;
+	return table[k] * (1 - t) + table[k + 1] * t;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <vector>
+#include "sph.h"
+#include "terrain_collision.h"
+
+// TERRAIN_PARTICLES puts a terrain particle on every heightmap vertex and finds them through the grid, they are only
+// used for the erosion. HEIGHTFIELD has no terrain particles, the terrain is a boundary for the density and pressure
+// and the erosion works from the distance to it, see HeightfieldBoundary.
+enum class BoundaryModel
+{
+	TERRAIN_PARTICLES,
+	HEIGHTFIELD,
+};
+
+// distance from a position to the terrain below it, along the terrain normal there
+struct BoundarySample
+{
+	float distance = 0;
+	glm::vec3 normal = glm::vec3(0, 1, 0);
+};
+
+// The terrain as a boundary of the fluid without boundary particles. Near a particle the terrain is taken as the plane
+// through the height below it with the terrain normal there, and everything under that plane as filled at the rest
+// density. The kernel integrals over that half space only depend on the distance to the plane, so they are tabulated
+// once for h and the density kernel:
+//   volume(d)    the part of the kernel under the plane, the boundary adds restDensity * volume to the density
+//   gradient(d)  d volume / d d, the boundary term of sum_j m_j grad W_ij is restDensity * gradient * normal
+//   pressure(d)  the kernel weighted direction to the boundary, for the equation of state pressure sweep
+// All three are 0 from h on, and distances under the terrain are taken as 0.
+class HeightfieldBoundary
+{
+public:
+	// rebuilds the tables when h or the density kernel changed
+	void update(const SPHSettings& settings);
+	void sample(const HeightfieldView& terrain, glm::vec3 position, BoundarySample& sample) const;
+
+	float getVolume(float distance) const { return lookup(volumes, distance); }
+	float getGradient(float distance) const { return lookup(gradients, distance); }
+	float getPressure(float distance) const { return lookup(pressures, distance); }
+	// restDensity * gradient * normal, zero when the sample is further than h
+	glm::vec3 getKernelGradient(const BoundarySample& sample, const SPHSettings& settings) const
+	{
+		return settings.restDensity * getGradient(sample.distance) * sample.normal;
+	}
+
+private:
+	float lookup(const std::vector<float>& table, float distance) const;
+
+	static const int tableSize = 1024;
+	std::vector<float> volumes;
+	std::vector<float> gradients;
+	std::vector<float> pressures;
+	float h = 0;
+	SPHKernel kernel = SPHKernel::SPIKY;
+};
@@ -14,11 +14,15 @@
 #include "mesh/sphere.h"
 #include "particle.h"
 #include "particle_generator.h"
+#include "simulation_thread.h"
+#include "sph_simd.h"
 #include "external/simpleppm.h"
 
 #include <iostream>
 
 #include <random>
+#include <thread>
+#include <algorithm>
 #include "imgui.h"
 
 #define GLM_FORCE_RADIANS
@@ -60,10 +64,13 @@ Skybox skybox(skyboxFacesLocation);
 HeightMap map;
 
 TerrainMesh* terrainMesh;
+// the simulation erodes its own copy of the terrain, terrainMesh only gets the published heights
+TerrainMesh* simTerrainMesh;
 WaterMesh* waterMesh;
 Sphere* sphere;
 Sphere* boundaryParticleSphere;
 ParticleGenerator* sphParticles;
+SimulationThread* simulation;
 
 ErosionModel erosionModel;
 SimulationParametersUI* simParams;
@@ -95,9 +102,9 @@ void raycastThroughScene()
 
 	for (int i = 0; i < terrainMesh->indices.size(); i += 3)
 	{
-		glm::vec3 triA = terrainMesh->vertices[terrainMesh->indices[i]].pos;
-		glm::vec3 triB = terrainMesh->vertices[terrainMesh->indices[i + 1]].pos;
-		glm::vec3 triC = terrainMesh->vertices[terrainMesh->indices[i + 2]].pos;
+		glm::vec3 triA = terrainMesh->getVertexPosition(terrainMesh->indices[i]);
+		glm::vec3 triB = terrainMesh->getVertexPosition(terrainMesh->indices[i + 1]);
+		glm::vec3 triC = terrainMesh->getVertexPosition(terrainMesh->indices[i + 2]);
 		glm::vec3 normal = glm::normalize(glm::cross(triC - triB, triA - triB));
 		float t = glm::dot(triA - camera.getPosition(), normal) / glm::dot(direction, normal);
 
@@ -153,7 +160,7 @@ void HandleKeyboardInputs()
 	if (erosionModel.castRays && erosionModel.isSimRunning && window.getMouseButton(GLFW_MOUSE_BUTTON_LEFT)) {
 		if (erosionModel.paintMode == PaintMode::WATER_ADD && cursorOverPosition != glm::vec3(INT_MIN))
 		{
-			sphParticles->addParticles(cursorOverPosition, erosionModel.brushRadius, erosionModel.brushIntensity);
+			simulation->addParticles(cursorOverPosition, erosionModel.brushRadius, erosionModel.brushIntensity);
 		}
 	}
 }
@@ -236,9 +243,33 @@ int main(int argc, char* argv[])
 		printf("default (n (1 - 11)) (randomness factor(0-4)) minH maxH \n");
 		printf("heightmap (filepath) \n");
 		printf("obj (filepath) (slopeHeight)\n");
+		printf("optionally followed by --threads n (defaults to the number of hardware threads)\n");
+		printf("and --terrain-particles (sample the terrain with boundary particles instead of the heightfield)\n");
 		return -1;
 	}
 
+	// take --threads out of the arguments, so the positions of the others stay the same
+	int threadCount = std::max(1u, std::thread::hardware_concurrency());
+	for (int i = 1; i < argc - 1; i++)
+	{
+		if (std::string(argv[i]) != "--threads") continue;
+		threadCount = std::max(1, std::stoi(argv[i + 1]));
+		for (int j = i; j + 2 < argc; j++)
+			argv[j] = argv[j + 2];
+		argc -= 2;
+		break;
+	}
+	BoundaryModel boundaryModel = BoundaryModel::HEIGHTFIELD;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::string(argv[i]) != "--terrain-particles") continue;
+		boundaryModel = BoundaryModel::TERRAIN_PARTICLES;
+		for (int j = i; j + 1 < argc; j++)
+			argv[j] = argv[j + 1];
+		argc -= 1;
+		break;
+	}
+
 	for (int i = 0; i < argc; i++)
 	{
 		printf(argv[i]);
@@ -263,7 +294,8 @@ int main(int argc, char* argv[])
 	simParams = new SimulationParametersUI(std::string(argv[1]) == "default");
 	// initModel();
 
-	terrainMesh = new TerrainMesh(map.getWidth(), map.getLength(), &map.heightMap, mainShader);
+	terrainMesh = new TerrainMesh(map.getHeightfield(), mainShader);
+	simTerrainMesh = new TerrainMesh(map.getHeightfield(), mainShader);
 
 	float particleRadius = 0.05;
 	sphere = new Sphere(glm::vec3(0), particleRadius, waterShader);
@@ -279,7 +311,15 @@ int main(int argc, char* argv[])
 	int numInOneCell = 1;
 	float h = 0.2;
 	SPHSettings settings = SPHSettings(1, 880, 580, 0.25, 0.01, h, -9.8f, 1.0f, 0.01f);
-	sphParticles = new ParticleGenerator(defaultShader, sphere, boundaryParticleSphere, &map, terrainMesh, terrainSpacing, h, particleRadius, numInOneCell, &settings);
+	settings.simdLevel = detectSimdLevel();
+	settings.threadCount = threadCount;
+	std::cout << "Running the simulation on " << threadCount << " threads" << std::endl;
+	std::cout << "Using " << getSimdLevelName(settings.simdLevel) << " sph sweeps" << std::endl;
+	// settings is edited by the ui, the simulation thread copies it into simSettings before each step
+	SPHSettings simSettings = settings;
+	sphParticles = new ParticleGenerator(defaultShader, sphere, boundaryParticleSphere, &map, simTerrainMesh, terrainSpacing, h, particleRadius, numInOneCell, &simSettings, GridMode::HASHED, boundaryModel);
+	simulation = new SimulationThread(sphParticles, &simSettings);
+	simulation->start();
 
 	glm::mat4 proj = glm::mat4(1.0f);
 	proj = glm::perspective(glm::radians(fov), window.getAspectRatio(), 0.1f, 1000.0f);
@@ -318,18 +358,21 @@ int main(int argc, char* argv[])
 		glm::mat4 view = camera.getViewMatrix();
 
 
-		if (erosionModel.isSimRunning) {
-			sphParticles->updateParticles(deltaTime, timePast);
+		// upload the newest step the simulation published, the render loop never waits for one
+		if (simulation->acquireFrame()) {
+			const SimulationFrame& frame = simulation->getFrame();
+			sphParticles->uploadFrame(frame);
+			terrainMesh->setHeights(frame.terrainHeights);
 			terrainMesh->update();
 		}
 
-		if (erosionModel.debugNeighbours)
-			sphParticles->debugNeighbours(deltaTime, timePast);
-
 		// drawing
 		UpdateShaders(view, proj, model, deltaTime);
 
-		window.Menu(&erosionModel , &settings, simParams);
+		window.Menu(&erosionModel , &settings, simParams, &simulation->getFrame().stats);
+		simulation->setSettings(settings);
+		simulation->setRunning(erosionModel.isSimRunning);
+		simulation->setDebugNeighbours(erosionModel.debugNeighbours);
 
 		ImGui::Render();
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -340,6 +383,8 @@ int main(int argc, char* argv[])
 		window.pollEvents();
 	}
 
+	simulation->stop();
+
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
@@ -50,69 +50,15 @@ void QuadMesh::calculateIndices()
 
 void QuadMesh::calculateNormals()
 {
-	for (int y = 0; y < length; y++)
-	{
-		for (int x = 0; x < width; x++)
-		{
-			glm::vec3 center = vertices[y * width + x].pos;
-
-			glm::vec3 top = y == length - 1 ? glm::vec3(0) : vertices[(y + 1) * width + x].pos;
-			glm::vec3 bottom = y == 0 ? glm::vec3(0) : vertices[(y - 1) * width + x].pos;
-			glm::vec3 right = x == width - 1 ? glm::vec3(0) : vertices[y * width + x + 1].pos;
-			glm::vec3 left = x == 0 ? glm::vec3(0) : vertices[y * width + x - 1].pos;
-
-			glm::vec3 v1 = normalize(right - center);
-			glm::vec3 v2 = normalize(top - center);
-			glm::vec3 v3 = normalize(left - center);
-			glm::vec3 v4 = normalize(bottom - center);
-
-			glm::vec3 normal1 = cross(v2, v1);
-			glm::vec3 normal2 = cross(v3, v2);
-			glm::vec3 normal3 = cross(v4, v3);
-			glm::vec3 normal4 = cross(v1, v4);
-
-			glm::vec3 normal = glm::vec3(0);
-
-			if (x == 0 || x == width - 1 || y == 0 || y == length - 1)
-			{
-				if (top == glm::vec3(0))
-				{
-					if (left != glm::vec3(0))
-						normal += normal3;
-					if (right != glm::vec3(0))
-						normal += normal4;
-				}
-				else if (bottom == glm::vec3(0))
-				{
-					if (left != glm::vec3(0))
-						normal += normal2;
-					if (right != glm::vec3(0))
-						normal += normal1;
-				}
-
-				if (left == glm::vec3(0))
-				{
-					if (top != glm::vec3(0))
-						normal += normal1;
-					if (bottom != glm::vec3(0))
-						normal += normal4;
-				}
-				else if (right == glm::vec3(0))
-				{
-					if (top != glm::vec3(0))
-						normal += normal2;
-					if (bottom != glm::vec3(0))
-						normal += normal3;
-				}
-			}
-			else
-			{
-				normal = normal1 + normal2 + normal3 + normal4;
-			}
+	calculateNormals(0, 0, width, length);
+}
 
-			vertices[y * width + x].normal = glm::normalize(normal);
-		}
-	}
+void QuadMesh::calculateNormals(int x0, int y0, int x1, int y1)
+{
+	auto position = [this](int x, int y) { return vertices[y * width + x].pos; };
+	for (int y = y0; y < y1; y++)
+		for (int x = x0; x < x1; x++)
+			vertices[y * width + x].normal = calculateGridNormal(width, length, x, y, position);
 }
 
 QuadMesh::QuadMesh(int width, int length, Shader shader)
@@ -15,6 +15,70 @@ protected:
 	virtual void calculateVertices(float*** height);
 	virtual void calculateIndices();
 	virtual void calculateNormals();
+	// only the vertices [x0, x1) x [y0, y1)
+	void calculateNormals(int x0, int y0, int x1, int y1);
 private:
 };
 
+// the normal of vertex (x, y) of a width x length grid, from the vertices around it. position(x, y) gives those
+template <typename Position>
+glm::vec3 calculateGridNormal(int width, int length, int x, int y, Position position)
+{
+	glm::vec3 center = position(x, y);
+
+	glm::vec3 top = y == length - 1 ? glm::vec3(0) : position(x, y + 1);
+	glm::vec3 bottom = y == 0 ? glm::vec3(0) : position(x, y - 1);
+	glm::vec3 right = x == width - 1 ? glm::vec3(0) : position(x + 1, y);
+	glm::vec3 left = x == 0 ? glm::vec3(0) : position(x - 1, y);
+
+	glm::vec3 v1 = normalize(right - center);
+	glm::vec3 v2 = normalize(top - center);
+	glm::vec3 v3 = normalize(left - center);
+	glm::vec3 v4 = normalize(bottom - center);
+
+	glm::vec3 normal1 = cross(v2, v1);
+	glm::vec3 normal2 = cross(v3, v2);
+	glm::vec3 normal3 = cross(v4, v3);
+	glm::vec3 normal4 = cross(v1, v4);
+
+	glm::vec3 normal = glm::vec3(0);
+
+	if (x == 0 || x == width - 1 || y == 0 || y == length - 1)
+	{
+		if (top == glm::vec3(0))
+		{
+			if (left != glm::vec3(0))
+				normal += normal3;
+			if (right != glm::vec3(0))
+				normal += normal4;
+		}
+		else if (bottom == glm::vec3(0))
+		{
+			if (left != glm::vec3(0))
+				normal += normal2;
+			if (right != glm::vec3(0))
+				normal += normal1;
+		}
+
+		if (left == glm::vec3(0))
+		{
+			if (top != glm::vec3(0))
+				normal += normal1;
+			if (bottom != glm::vec3(0))
+				normal += normal4;
+		}
+		else if (right == glm::vec3(0))
+		{
+			if (top != glm::vec3(0))
+				normal += normal2;
+			if (bottom != glm::vec3(0))
+				normal += normal3;
+		}
+	}
+	else
+	{
+		normal = normal1 + normal2 + normal3 + normal4;
+	}
+
+	return glm::normalize(normal);
+}
@@ -4,7 +4,7 @@
 #define PI 3.14159265359
 
 Sphere::Sphere(Sphere* sphere)
-    :Mesh(sphere->shader), radius(sphere->radius)
+    :Mesh(sphere->shader), streams(declareStreams()), radius(sphere->radius)
 {
     vertices = sphere->vertices;
     indices = sphere->indices;
@@ -12,7 +12,7 @@ Sphere::Sphere(Sphere* sphere)
 }
 
 Sphere::Sphere(glm::vec3 center, float radius, Shader shader)
-	:Mesh(shader), center(center), radius(radius)
+	:Mesh(shader), streams(declareStreams()), center(center), radius(radius)
 {
     // taken from 
     // http://www.songho.ca/opengl/gl_sphere.html
@@ -98,6 +98,14 @@ Sphere::Sphere(glm::vec3 center, float radius, Shader shader)
     }
 }
 
+std::vector<VertexStream> Sphere::declareStreams()
+{
+    return {
+        { "pos", 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), GL_STATIC_DRAW },
+        { "normal", 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), GL_STATIC_DRAW },
+        { "uv", 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), GL_STATIC_DRAW } };
+}
+
 void Sphere::init()
 {
     glBindVertexArray(VAO);
@@ -105,19 +113,22 @@ void Sphere::init()
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices[0]) * indices.size(), indices.data(), GL_STATIC_DRAW);
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices[0]) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
-
-    glEnableVertexAttribArray(shader.getAttribLocation("pos"));
-    glEnableVertexAttribArray(shader.getAttribLocation("normal"));
-    glEnableVertexAttribArray(shader.getAttribLocation("uv"));
-    glVertexAttribPointer(shader.getAttribLocation("pos"), 3, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(0));
-    glVertexAttribPointer(shader.getAttribLocation("normal"), 3, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(sizeof(vertices[0].pos)));
-    glVertexAttribPointer(shader.getAttribLocation("uv"), 2, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(sizeof(vertices[0].pos) + sizeof(vertices[0].normal)));
+    streams.init(shader, (uint32_t)vertices.size());
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
+
+    std::vector<glm::vec3> positions, normals;
+    std::vector<glm::vec2> uvs;
+    for (const Vertex& vertex : vertices)
+    {
+        positions.push_back(vertex.pos);
+        normals.push_back(vertex.normal);
+        uvs.push_back(vertex.uv);
+    }
+    streams.upload(POSITION_STREAM, positions.data());
+    streams.upload(NORMAL_STREAM, normals.data());
+    streams.upload(UV_STREAM, uvs.data());
 }
 
 void Sphere::draw()
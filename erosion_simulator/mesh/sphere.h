@@ -2,6 +2,7 @@
 #include "glm/glm.hpp"
 #include "shader/shader.h"
 #include "mesh.h"
+#include "vertex_streams.h"
 
 class Sphere : public Mesh
 {
@@ -11,6 +12,10 @@ public:
 	virtual void init() override;
 	virtual void draw() override;
 private:
+	enum Stream { POSITION_STREAM, NORMAL_STREAM, UV_STREAM };
+	static std::vector<VertexStream> declareStreams();
+
+	VertexStreams streams;
 	glm::vec3 center;
 	int radius;
 };
@@ -1,80 +1,88 @@
 #include "terrain_mesh.h"
 #include "cellposition.hpp"
-
-TerrainMesh::TerrainMesh(int width, int length, float*** terrainHeights, Shader shader)
-	:QuadMesh(width, length, shader)
+#include <algorithm>
+
+TerrainMesh::TerrainMesh(const Heightfield& heights, Shader shader)
+	:QuadMesh(heights.getWidth(), heights.getLength(), shader), heightfield(heights),
+	streams({
+		{ "height", 1, GL_FLOAT, GL_FALSE, sizeof(float), GL_DYNAMIC_DRAW },
+		{ "normal", 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(uint32_t), GL_DYNAMIC_DRAW },
+		{ "originalHeight", 1, GL_FLOAT, GL_FALSE, sizeof(float), GL_STATIC_DRAW } })
 {
-	originalHeights = new float[width * length];
 	offset = glm::vec2(width / 2, length / 2);
+	heightfield.storeOriginal();
 
-	for (int y = 0; y < length; y++)
-	{
-		for (int x = 0; x < width; x++)
-		{
-			originalHeights[y * width + x] = (*terrainHeights)[x][y];
-		}
-	}
-
-	calculateVertices(terrainHeights);
-	updateOriginalHeights();
 	calculateIndices();
 	calculateNormals();
 }
 
-TerrainMesh::TerrainMesh(int width, int length, HeightMap* heightMap, Shader shader)
-	:QuadMesh(width, length, shader)
+TerrainMesh::~TerrainMesh()
 {
-	originalHeights = new float[width * length];
-	offset = glm::vec2(width / 2, length / 2);
-
-	for (int y = 0; y < length; y++)
-	{
-		for (int x = 0; x < width; x++)
-		{
-			originalHeights[y * length + x] = heightMap->sampleHeightAtIndex(x,y);
-		}
-	}
+}
 
-	calculateVertices(heightMap); 
-	updateOriginalHeights();
+void TerrainMesh::updateMeshFromHeights(const Heightfield& heights)
+{
+	heightfield = heights;
+	heightfield.storeOriginal();
+	clearData();
 	calculateIndices();
 	calculateNormals();
+	uploadStreams();
 }
 
-TerrainMesh::~TerrainMesh()
+void TerrainMesh::updateMeshFromMap(HeightMap* heightMap)
 {
+	updateMeshFromHeights(heightMap->getHeightfield());
 }
 
-void TerrainMesh::updateMeshFromHeights(float*** heights)
+void TerrainMesh::updateOriginalHeights()
 {
-	clearData();
-	calculateVertices(heights);
-	updateOriginalHeights();
-	calculateIndices();
-	calculateNormals();
-	update();
+	heightfield.storeOriginal();
+	streams.upload(ORIGINAL_HEIGHT_STREAM, heightfield.getOriginalData());
 }
 
-void TerrainMesh::updateOriginalHeights()
+void TerrainMesh::update()
 {
-	for (int y = 0; y < length; y++)
+	if (dirtyTiles.empty()) return;
+
+	// a height changes the normals of the vertices next to it, so the tile plus a one vertex border
+	for (uint32_t tile : dirtyTiles)
 	{
-		for (int x = 0; x < width; x++)
-		{
-			vertices[y * width + x].height = originalHeights[y * width + x];
-		}
+		int x0, y0, x1, y1;
+		heightfield.getTileBounds(tile, x0, y0, x1, y1);
+		calculateNormals(std::max(0, x0 - 1), std::max(0, y0 - 1), std::min(width, x1 + 1), std::min(length, y1 + 1));
 	}
-}
 
-void TerrainMesh::updateOriginalHeights(float*** heights)
-{
-	for (int y = 0; y < length; y++)
+	packTerrainUpload(heightfield, normals, dirtyTiles, upload);
+	for (const TerrainUploadSpan& span : upload.spans)
 	{
-		for (int x = 0; x < width; x++)
-		{
-			originalHeights[y * length + x] = (*heights)[x][y];
-		}
+		streams.uploadRange(HEIGHT_STREAM, span.firstVertex, span.count, upload.heights.data() + span.dataOffset);
+		streams.uploadRange(NORMAL_STREAM, span.firstVertex, span.count, upload.normals.data() + span.dataOffset);
 	}
+	for (uint32_t tile : dirtyTiles)
+		tileDirty[tile] = 0;
+	dirtyTiles.clear();
+}
+
+void TerrainMesh::calculateNormals()
+{
+	calculateNormals(0, 0, width, length);
+}
+
+void TerrainMesh::calculateNormals(int x0, int y0, int x1, int y1)
+{
+	normals.resize(width * length);
+	auto position = [this](int x, int y) { return getPositionAtIndex(x, y); };
+	for (int y = y0; y < y1; y++)
+		for (int x = x0; x < x1; x++)
+			normals[y * width + x] = packNormal(calculateGridNormal(width, length, x, y, position));
+}
+
+void TerrainMesh::uploadStreams()
+{
+	streams.upload(HEIGHT_STREAM, heightfield.data());
+	streams.upload(NORMAL_STREAM, normals.data());
+	streams.upload(ORIGINAL_HEIGHT_STREAM, heightfield.getOriginalData());
 }
 
 void TerrainMesh::init()
@@ -84,31 +92,35 @@ void TerrainMesh::init()
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices[0]) * indices.size(), indices.data(), GL_STATIC_DRAW);
 
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices[0]) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+	streams.init(shader, getVertexCount());
 
-	glEnableVertexAttribArray(shader.getAttribLocation("pos"));
-	glEnableVertexAttribArray(shader.getAttribLocation("normal"));
-	glEnableVertexAttribArray(shader.getAttribLocation("uv"));
-	glEnableVertexAttribArray(shader.getAttribLocation("originalHeight"));
-	glVertexAttribPointer(shader.getAttribLocation("pos"), 3, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(0));
-	glVertexAttribPointer(shader.getAttribLocation("normal"), 3, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(sizeof(vertices[0].pos)));
-	glVertexAttribPointer(shader.getAttribLocation("uv"), 2, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(sizeof(vertices[0].pos) + sizeof(vertices[0].normal)));
-	glVertexAttribPointer(shader.getAttribLocation("originalHeight"), 1, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(sizeof(vertices[0].pos) + sizeof(vertices[0].normal) + sizeof(vertices[0].uv)));
-
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
+
+	uploadStreams();
+}
+
+void TerrainMesh::draw()
+{
+	// the vertex shader places the vertices on the grid from their index
+	shader.setUniformInt("gridWidth", width);
+	shader.setUniformInt("gridLength", length);
+	Mesh::draw();
 }
 
 glm::vec3 TerrainMesh::getNormalAtIndex(int x, int y) const
 {
-	return vertices[y * width + x].normal;
+	return unpackNormal(normals[y * width + x]);
+}
+
+glm::vec3 TerrainMesh::getVertexPosition(uint32_t vertex) const
+{
+	return getPositionAtIndex(vertex % width, vertex / width);
 }
 
 glm::vec3 TerrainMesh::getPositionAtIndex(int x, int y) const
 {
-	return vertices[y * width + x].pos;
+	return glm::vec3(x - offset.x, heightfield.at(x, y), y - offset.y);
 }
 
 float TerrainMesh::sampleHeightAtPosition(float x, float y) const {
@@ -122,10 +134,10 @@ float TerrainMesh::sampleHeightAtPosition(float x, float y) const {
 	// Sample the heightmap at each of the cell's corner.
 	if (cell.xLeft < 0 || cell.xLeft >= width || cell.yDown < 0 || cell.yDown >= length) return 0;
 	if (cell.xRight < 0 || cell.xRight >= width || cell.yUp < 0 || cell.yUp >= length) return 0;
-	float bottomLeftHeight = vertices[cell.yDown * width + cell.xLeft].pos.y;
-	float bottomRightHeight = vertices[cell.yDown * width + cell.xRight].pos.y;
-	float topLeftHeight = vertices[cell.yUp * width + cell.xLeft].pos.y;
-	float topRightHeight = vertices[cell.yUp * width + cell.xRight].pos.y;
+	float bottomLeftHeight = heightfield.at(cell.xLeft, cell.yDown);
+	float bottomRightHeight = heightfield.at(cell.xRight, cell.yDown);
+	float topLeftHeight = heightfield.at(cell.xLeft, cell.yUp);
+	float topRightHeight = heightfield.at(cell.xRight, cell.yUp);
 
 	// Adjust the weight of each sample by how close the target position is to it.
 	bottomLeftHeight *= (1 - cell.xWeight) * (1 - cell.yWeight);
@@ -138,6 +150,13 @@ float TerrainMesh::sampleHeightAtPosition(float x, float y) const {
 }
 
 void TerrainMesh::modify_height(float x, float y, float amount) {
+	std::vector<HeightDelta> deltas;
+	gatherHeightDeltas(x, y, amount, deltas);
+	for (const HeightDelta& delta : deltas)
+		applyHeightDelta(delta);
+}
+
+void TerrainMesh::gatherHeightDeltas(float x, float y, float amount, std::vector<HeightDelta>& deltas) const {
 	x += offset.x;
 	y += offset.y;
 	CellPosition cell(x, y);
@@ -153,27 +172,57 @@ void TerrainMesh::modify_height(float x, float y, float amount) {
 		(1 - cell.xWeight) * (cell.yWeight), // top-left
 		cell.xWeight * cell.yWeight // top-right
 	};
-	Vertex* cellVertices[] = {
-		&vertices[cell.yDown * width + cell.xLeft], // bottom-left
-		&vertices[cell.yDown * width + cell.xRight], // bottom-right
-		&vertices[cell.yUp * width + cell.xLeft], // top-left
-		&vertices[cell.yUp * width + cell.xRight] // top-right
+	int cellVertices[] = {
+		cell.yDown * width + cell.xLeft, // bottom-left
+		cell.yDown * width + cell.xRight, // bottom-right
+		cell.yUp * width + cell.xLeft, // top-left
+		cell.yUp * width + cell.xRight // top-right
 	};
 
 	for (int i = 0; i < sizeof(weights) / sizeof(float); i++)
-	{
-		// Compute the new height for each vertex.
-		float newHeight = cellVertices[i]->pos.y + amount * weights[i];
+		deltas.push_back({ (uint32_t)cellVertices[i], amount * weights[i] });
+}
+
+bool TerrainMesh::getCellVertices(float x, float y, uint32_t cellVertices[4]) const {
+	x += offset.x;
+	y += offset.y;
+	CellPosition cell(x, y);
 
-		// Limit the minimum height to 0.
-		if (newHeight <= -length) cellVertices[i]->pos.y = -length;
-		else cellVertices[i]->pos.y = newHeight;
+	if (cell.xLeft < 0 || cell.xLeft >= width || cell.yDown < 0 || cell.yDown >= length) return false;
+	if (cell.xRight < 0 || cell.xRight >= width || cell.yUp < 0 || cell.yUp >= length) return false;
+	cellVertices[0] = cell.yDown * width + cell.xLeft;
+	cellVertices[1] = cell.yDown * width + cell.xRight;
+	cellVertices[2] = cell.yUp * width + cell.xLeft;
+	cellVertices[3] = cell.yUp * width + cell.xRight;
+	return true;
+}
+
+void TerrainMesh::applyHeightDelta(const HeightDelta& delta) {
+	// Compute the new height for the vertex.
+	float newHeight = heightfield[delta.vertex] + delta.amount;
+
+	// Limit the minimum height to 0.
+	if (newHeight <= -length) heightfield[delta.vertex] = -length;
+	else heightfield[delta.vertex] = newHeight;
+	heightfield.markChanged(delta.vertex);
+}
+
+void TerrainMesh::setHeights(const Heightfield& newHeights) {
+	copiedTiles.clear();
+	heightfield.copyChangedTiles(newHeights, copiedTiles);
+	tileDirty.resize(heightfield.getTileCount());
+	for (uint32_t tile : copiedTiles)
+	{
+		if (tileDirty[tile]) continue;
+		tileDirty[tile] = 1;
+		dirtyTiles.push_back(tile);
 	}
 }
 
 void TerrainMesh::modify_height_at_index(int x, int z, float amount)
 {
-	vertices[x * width + z].pos.y += amount;
+	heightfield[x * width + z] += amount;
+	heightfield.markChanged(x * width + z);
 }
 
 glm::vec3 TerrainMesh::sampleNormalAtPosition(float x, float y) const
@@ -1,29 +1,74 @@
 #pragma once
 #include "quad_mesh.h"
-#include "sph_particle.h"
+#include "terrain_collision.h"
+#include "terrain_upload.h"
+#include "vertex_streams.h"
 
+// one vertex height change of modify_height, gathered first and applied later with applyHeightDelta
+struct HeightDelta
+{
+	uint32_t vertex;
+	float amount;
+};
+
+// The heights live in the heightfield, the erosion and the collision read and write only that. There are no Vertex
+// for the terrain: the shader takes the heights, the packed normals and the original heights as streams of their own
+// (12 bytes a vertex, 8 of them change) and works out x, z and the uv from the vertex index.
+// update() only sends the heights and normals of the dirty tiles.
 class TerrainMesh :  public QuadMesh
 {
 public:
-	TerrainMesh(int width, int length, float*** terrainHeights, Shader shader);
-	TerrainMesh(int width, int length, HeightMap* heightMap, Shader shader);
+	TerrainMesh(const Heightfield& heights, Shader shader);
 	~TerrainMesh();	
 
-	virtual void updateMeshFromHeights(float*** heights) override;
+	void updateMeshFromHeights(const Heightfield& heights);
+	void updateMeshFromMap(HeightMap* heightMap);
+	// the current heights become the original ones
 	void updateOriginalHeights();
-	void updateOriginalHeights(float*** heights);
 	virtual void init() override;
+	virtual void draw() override;
+	// recomputes the normals of the dirty tiles and uploads their heights and normals.
+	// does nothing when no tile is dirty
+	void update();
 
 	glm::vec3 getNormalAtIndex(int x, int y) const;
 	glm::vec3 getPositionAtIndex(int x, int y) const;
+	// of vertex y * width + x, what the indices refer to
+	glm::vec3 getVertexPosition(uint32_t vertex) const;
 	float sampleHeightAtPosition(float x, float y) const;
 	glm::vec3 sampleNormalAtPosition(float x, float y) const;
 	glm::vec3 sampleWeightedNormalAtPosition(float x, float y) const;
 	void modify_height(float, float, float);
+	// the changes modify_height(x, y, amount) would make, appended to deltas. only reads the mesh
+	void gatherHeightDeltas(float x, float y, float amount, std::vector<HeightDelta>& deltas) const;
+	void applyHeightDelta(const HeightDelta& delta);
+	// the four vertices of the cell (x, y) lies in, false outside of the mesh
+	bool getCellVertices(float x, float y, uint32_t cellVertices[4]) const;
+	// copies the tiles of the heights published by the simulation that changed, and marks them dirty.
+	// call update after to upload them
+	void setHeights(const Heightfield& newHeights);
+	// tiles of the heightfield (see Heightfield::getTileBounds) changed since the last update
+	const std::vector<uint32_t>& getDirtyTiles() const { return dirtyTiles; }
+	uint32_t getVertexCount() const { return (uint32_t)(width * length); }
+	const Heightfield& getHeightfield() const { return heightfield; }
+	HeightfieldView getHeightfieldView() const { return { heightfield.data(), width, length, offset }; }
 	void modify_height_at_index(int, int, float);
 private:
+	enum Stream { HEIGHT_STREAM, NORMAL_STREAM, ORIGINAL_HEIGHT_STREAM };
 
-	float* originalHeights;
+	virtual void calculateNormals() override;
+	// only the vertices [x0, x1) x [y0, y1)
+	void calculateNormals(int x0, int y0, int x1, int y1);
+	// all the vertices of all the streams
+	void uploadStreams();
+
+	Heightfield heightfield;
 	glm::vec2 offset;
+	std::vector<uint32_t> dirtyTiles;
+	std::vector<uint8_t> tileDirty;
+	std::vector<uint32_t> copiedTiles;
+	// packed, see packNormal
+	std::vector<uint32_t> normals;
+	VertexStreams streams;
+	TerrainUpload upload;
 };
-
@@ -0,0 +1,52 @@
+#include "terrain_upload.h"
+#include <algorithm>
+
+void packTerrainUpload(const Heightfield& heights, const std::vector<uint32_t>& normals, const std::vector<uint32_t>& tiles,
+	TerrainUpload& upload)
+{
+	upload.heights.clear();
+	upload.normals.clear();
+	upload.spans.clear();
+	upload.rows.clear();
+
+	int width = heights.getWidth();
+	int length = heights.getLength();
+	for (uint32_t tile : tiles)
+	{
+		int x0, y0, x1, y1;
+		heights.getTileBounds(tile, x0, y0, x1, y1);
+		x0 = std::max(0, x0 - 1);
+		y0 = std::max(0, y0 - 1);
+		x1 = std::min(width, x1 + 1);
+		y1 = std::min(length, y1 + 1);
+		for (int y = y0; y < y1; y++)
+			upload.rows.push_back({ (uint32_t)(y * width + x0), (uint32_t)(y * width + x1) });
+	}
+
+	// rows that overlap or follow each other become one span, a whole row of dirty tiles is then a single span
+	std::sort(upload.rows.begin(), upload.rows.end());
+	for (const auto& row : upload.rows)
+	{
+		if (!upload.spans.empty())
+		{
+			TerrainUploadSpan& last = upload.spans.back();
+			uint32_t lastEnd = last.firstVertex + last.count;
+			if (row.first <= lastEnd)
+			{
+				last.count = std::max(lastEnd, row.second) - last.firstVertex;
+				continue;
+			}
+		}
+		upload.spans.push_back({ row.first, row.second - row.first, 0 });
+	}
+
+	for (TerrainUploadSpan& span : upload.spans)
+	{
+		span.dataOffset = (uint32_t)upload.heights.size();
+		for (uint32_t i = span.firstVertex; i < span.firstVertex + span.count; i++)
+		{
+			upload.heights.push_back(heights[i]);
+			upload.normals.push_back(normals[i]);
+		}
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "height_map/heightfield.h"
+
+// count consecutive vertices starting at firstVertex, packed at heights[dataOffset] and normals[dataOffset]
+struct TerrainUploadSpan
+{
+	uint32_t firstVertex;
+	uint32_t count;
+	uint32_t dataOffset;
+};
+
+// The heights and normals of a set of dirty tiles, ready for one glBufferSubData per span and stream.
+// A height changes the normals one vertex past the edge of its tile, so every tile is packed with a one vertex
+// border. The rows of those overlap and touch each other, they are merged into as few spans as possible.
+struct TerrainUpload
+{
+	std::vector<float> heights;
+	// packed, see packNormal
+	std::vector<uint32_t> normals;
+	std::vector<TerrainUploadSpan> spans;
+	// [first, end) vertex of every row before merging, kept to not allocate every frame
+	std::vector<std::pair<uint32_t, uint32_t>> rows;
+};
+
+// packs the heights and the normals of the tiles. only reads memory, doesn't need a gl context
+void packTerrainUpload(const Heightfield& heights, const std::vector<uint32_t>& normals, const std::vector<uint32_t>& tiles,
+	TerrainUpload& upload);
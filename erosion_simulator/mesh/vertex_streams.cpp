@@ -0,0 +1,63 @@
+#include "vertex_streams.h"
+#include <cstdio>
+
+VertexStreams::VertexStreams(std::vector<VertexStream> streams)
+	: streams(streams)
+{
+}
+
+VertexStreams::~VertexStreams()
+{
+	if (!buffers.empty())
+		glDeleteBuffers((GLsizei)buffers.size(), buffers.data());
+}
+
+void VertexStreams::init(Shader& shader, uint32_t vertexCount)
+{
+	if (!buffers.empty())
+		glDeleteBuffers((GLsizei)buffers.size(), buffers.data());
+	this->vertexCount = vertexCount;
+	buffers.resize(streams.size());
+	glGenBuffers((GLsizei)buffers.size(), buffers.data());
+
+	for (size_t i = 0; i < streams.size(); i++)
+	{
+		const VertexStream& stream = streams[i];
+		glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)stream.bytesPerVertex * vertexCount, nullptr, stream.usage);
+
+		// -1 when the shader doesn't have the attribute, or the compiler optimised it out.
+		// the buffer is still kept so the uploads don't have to care
+		GLint location = (GLint)shader.getAttribLocation(stream.attribute);
+		if (location < 0)
+		{
+			printf("The shader has no vertex attribute %s, its stream is left unbound\n", stream.attribute);
+			continue;
+		}
+		glEnableVertexAttribArray(location);
+		glVertexAttribPointer(location, stream.components, stream.type, stream.normalized, stream.bytesPerVertex, (const GLvoid*)(0));
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void VertexStreams::upload(uint32_t stream, const void* data)
+{
+	uploadRange(stream, 0, vertexCount, data);
+}
+
+void VertexStreams::uploadRange(uint32_t stream, uint32_t firstVertex, uint32_t count, const void* data)
+{
+	if (buffers.empty() || count == 0) return;
+	uint32_t size = streams[stream].bytesPerVertex;
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[stream]);
+	glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)size * firstVertex, (GLsizeiptr)size * count, data);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+uint32_t VertexStreams::getBytesPerVertex() const
+{
+	uint32_t bytes = 0;
+	for (const VertexStream& stream : streams)
+		bytes += stream.bytesPerVertex;
+	return bytes;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+#include "glm/gtc/packing.hpp"
+#include "shader/shader.h"
+
+// one attribute of the shader, read from a tightly packed buffer of its own
+struct VertexStream
+{
+	const char* attribute;
+	GLint components;
+	GLenum type;
+	// integer types are read as -1..1 (or 0..1) floats
+	GLboolean normalized;
+	uint32_t bytesPerVertex;
+	GLenum usage;
+};
+
+// The streams a mesh declares, a buffer each. A mesh only declares what its shader reads, anything that follows from
+// the vertex index (like the x and z of a grid) is left to gl_VertexID. Every stream is filled on its own, so the ones
+// that change can be uploaded without the ones that don't.
+class VertexStreams
+{
+public:
+	VertexStreams(std::vector<VertexStream> streams);
+	~VertexStreams();
+	VertexStreams(const VertexStreams&) = delete;
+	VertexStreams& operator=(const VertexStreams&) = delete;
+
+	// (re)creates the buffers for vertexCount vertices and points the attributes of the shader at them.
+	// call with the VAO of the mesh bound
+	void init(Shader& shader, uint32_t vertexCount);
+	// all the vertices of the stream, nothing before init
+	void upload(uint32_t stream, const void* data);
+	// count vertices starting at firstVertex
+	void uploadRange(uint32_t stream, uint32_t firstVertex, uint32_t count, const void* data);
+	uint32_t getVertexCount() const { return vertexCount; }
+	// of all the streams together
+	uint32_t getBytesPerVertex() const;
+
+private:
+	std::vector<VertexStream> streams;
+	std::vector<uint32_t> buffers;
+	uint32_t vertexCount = 0;
+};
+
+// normals as GL_INT_2_10_10_10_REV, 4 bytes instead of 12. declare the stream with 4 components, normalized
+inline uint32_t packNormal(glm::vec3 normal) { return glm::packSnorm3x10_1x2(glm::vec4(normal, 0)); }
+inline glm::vec3 unpackNormal(uint32_t normal) { return glm::vec3(glm::unpackSnorm3x10_1x2(normal)); }
@@ -0,0 +1,88 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+// Read only view over the neighbour indices of one particle, handed to the sph functions instead of a vector copy.
+struct NeighbourSpan
+{
+	const uint32_t* data;
+	uint32_t count;
+	// cached squared and plain distance to each neighbour, nullptr when the list has no distances cached
+	const float* distances2 = nullptr;
+	const float* distances = nullptr;
+
+	uint32_t size() const { return count; }
+	uint32_t operator[](uint32_t i) const { return data[i]; }
+	const uint32_t* begin() const { return data; }
+	const uint32_t* end() const { return data + count; }
+};
+
+// Neighbours of every particle for one step, stored flat (CSR):
+// the neighbours of particle i are indices[offsets[i]] to indices[offsets[i + 1]].
+// The buffers are kept between steps so rebuilding does not allocate once they have grown.
+struct NeighbourList
+{
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> indices;
+	// filled per step (positions change even when the indices don't), indexed like indices
+	std::vector<float> distances2;
+	std::vector<float> distances;
+
+	void clear()
+	{
+		offsets.clear();
+		indices.clear();
+		offsets.push_back(0);
+		clearDistances();
+	}
+
+	void clearDistances()
+	{
+		distances2.clear();
+		distances.clear();
+	}
+
+	// sizes the distances to the indices, they are then filled by cachePairDistances
+	void resizeDistances()
+	{
+		distances2.resize(indices.size());
+		distances.resize(indices.size());
+	}
+
+	// appends the particles of another list, built for the particles following the ones in this list
+	void append(const NeighbourList& other)
+	{
+		uint32_t base = (uint32_t)indices.size();
+		indices.insert(indices.end(), other.indices.begin(), other.indices.end());
+		for (size_t i = 1; i < other.offsets.size(); i++)
+			offsets.push_back(base + other.offsets[i]);
+	}
+
+	// call after appending the neighbours of the next particle to indices
+	void endParticle() { offsets.push_back((uint32_t)indices.size()); }
+
+	size_t particleCount() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+
+	NeighbourSpan operator[](size_t i) const
+	{
+		NeighbourSpan span{ indices.data() + offsets[i], offsets[i + 1] - offsets[i] };
+		if (!distances2.empty())
+		{
+			span.distances2 = distances2.data() + offsets[i];
+			span.distances = distances.data() + offsets[i];
+		}
+		return span;
+	}
+
+	// keeps only the neighbours j > i of a full (symmetric) list, so every pair is listed once
+	void assignHalf(const NeighbourList& full)
+	{
+		clear();
+		for (uint32_t i = 0; i < full.particleCount(); i++)
+		{
+			for (uint32_t j : full[i])
+				if (j > i) indices.push_back(j);
+			endParticle();
+		}
+	}
+};
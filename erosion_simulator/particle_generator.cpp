@@ -1,12 +1,19 @@
 #include "particle_generator.h"
+#include "sph_kernels.h"
+#include "sph_simd.h"
+#include "pcisph.h"
+#include "dfsph.h"
+#include "pbf.h"
 #include <iostream>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/norm.hpp>
 #include <exception>
-#include <unordered_map>
+#include <algorithm>
 
-ParticleGenerator::ParticleGenerator(Shader& shader, Mesh* sphMesh, Mesh* boundaryMesh, HeightMap* map, TerrainMesh* terrain, float terrainSpacing, float cellSize, float particleRadius, int numPerSquare, SPHSettings* settings)
-	:shader(shader), particleMesh(sphMesh), terrainParticlesMesh(boundaryMesh), _heightmap(map), terrain(terrain), settings(settings)
+ParticleGenerator::ParticleGenerator(Shader& shader, Mesh* sphMesh, Mesh* boundaryMesh, HeightMap* map, TerrainMesh* terrain, float terrainSpacing, float cellSize, float particleRadius, int numPerSquare, SPHSettings* settings, GridMode gridMode,
+	BoundaryModel boundaryModel)
+	:shader(shader), particleMesh(sphMesh), terrainParticlesMesh(boundaryMesh), _heightmap(map), terrain(terrain), settings(settings), sphParticles(particleRadius),
+	boundaryModel(boundaryModel)
 {
 	float mapWidth = _heightmap->getWidth();
 	float mapLength = _heightmap->getLength();
@@ -26,18 +33,18 @@ ParticleGenerator::ParticleGenerator(Shader& shader, Mesh* sphMesh, Mesh* bounda
 					(float)x * sphOffset - (float)(mapWidth - 1) / 8 + sphOffset,
 					(float)(((maxHeight - 1) / 2 - y * sphOffset)) - sphOffset,
 					(float)z * sphOffset - (float)(mapLength - 1) / 8 + sphOffset);
-				SphParticle* sphPart = new SphParticle(pos * terrainSpacing, particleRadius);
-				sphParticles.push_back(sphPart);
-				particleModels.push_back(glm::translate(glm::mat4(1), sphPart->getPosition()));
+				uint32_t sphPart = sphParticles.add(pos * terrainSpacing);
+				particleModels.push_back(glm::translate(glm::mat4(1), sphParticles.getPosition(sphPart)));
 				sphParticleDebugs.push_back(SPHParticleDebug());
 
 				if (rand() % 100 == x || rand() % 100 == z)
-					sphPart->setSediment(0.1);
+					sphParticles.sediment[sphPart] = 0.1;
 			}
 		}
 	}
 
-	for (int x = 0; x < mapWidth; x++) {
+	// one per heightmap vertex, the heightfield boundary does without them
+	for (int x = 0; boundaryModel == BoundaryModel::TERRAIN_PARTICLES && x < mapWidth; x++) {
 		for (int y = 0; y < mapLength; y++) {
 			glm::vec3 position = map->getPositionAtIndex(x, y);
 			TerrainParticle* terrainPart = new TerrainParticle(position, particleRadius, x, y);
@@ -135,9 +142,10 @@ ParticleGenerator::ParticleGenerator(Shader& shader, Mesh* sphMesh, Mesh* bounda
 
 	glBindVertexArray(0);
 
-	std::vector<SphParticle*> sphParticleVector(sphParticles.begin(), sphParticles.end()); // turn vector<SphParticle*> into vector<Particle*> (implicit casting isn't possible)
-	std::vector<TerrainParticle*> terrainParticleVector(terrainParticles.begin(), terrainParticles.end());
-	grid = Grid3D(mapWidth - 1, mapLength - 1, height, terrainSpacing, cellSize, sphParticleVector, terrainParticleVector, shader);
+	drawnParticleCount = particleModels.size();
+	drawnTerrainParticleCount = particleModelsTerrain.size();
+
+	grid = Grid3D(mapWidth - 1, mapLength - 1, height, terrainSpacing, cellSize, sphParticles, terrainParticles, shader, gridMode);
 
 	//settings.restDensity = ((mapWidth - 1) * (mapLength - 1) * height) / (settings.mass * sphParticles.size()) * cellSize;
 
@@ -148,46 +156,347 @@ ParticleGenerator::ParticleGenerator(Shader& shader, Mesh* sphMesh, Mesh* bounda
 
 void ParticleGenerator::drawParticles()
 {
-	particleMesh->drawInstanced(particleModels.size());
+	particleMesh->drawInstanced(drawnParticleCount);
 }
 
 void ParticleGenerator::drawTerrainParticles()
 {
-	terrainParticlesMesh->drawInstanced(particleModelsTerrain.size());
+	terrainParticlesMesh->drawInstanced(drawnTerrainParticleCount);
 }
 
 void ParticleGenerator::drawGridDebug()
 {
-	grid.draw();
+	grid.draw(drawnGridCells);
+}
+
+// each thread builds the lists of its range of particles into its own part, the parts are then joined in thread order.
+// append(i, indices) appends the neighbours of particle i.
+template <typename Append>
+void ParticleGenerator::buildNeighbourList(NeighbourList& list, Append append)
+{
+	threadNeighbours.resize(pool.getThreadCount());
+	for (NeighbourList& part : threadNeighbours)
+		part.clear();
+
+	pool.parallelFor((uint32_t)sphParticles.size(), [&](uint32_t begin, uint32_t end, int thread) {
+		NeighbourList& part = threadNeighbours[thread];
+		for (uint32_t i = begin; i < end; i++)
+		{
+			append(i, part.indices);
+			part.endParticle();
+		}
+	});
+
+	list.clear();
+	for (const NeighbourList& part : threadNeighbours)
+		list.append(part);
+}
+
+void ParticleGenerator::buildNeighbourLists()
+{
+	// the boundary list is searched every step, erosion acts on every terrain particle it contains
+	if (boundaryModel == BoundaryModel::TERRAIN_PARTICLES)
+	{
+		grid.updateTerrainParticles(terrainParticles);
+		buildNeighbourList(boundaryNeighbours, [&](uint32_t i, std::vector<uint32_t>& indices) {
+			grid.appendNeighbouringTerrainPaticles(terrainParticles, sphParticles.getPosition(i), indices);
+		});
+	}
+
+	if (settings->useVerletLists && verletListsValid())
+	{
+		stats.stepsSinceNeighbourRebuild++;
+		return;
+	}
+
+	grid.updateSphParticles(sphParticles);
+	sphHalfNeighboursValid = false;
+
+	if (!settings->useVerletLists)
+	{
+		buildNeighbourList(sphNeighbours, [&](uint32_t i, std::vector<uint32_t>& indices) {
+			grid.appendNeighbouringSPHPaticles(sphParticles, i, indices);
+		});
+		verletPositions.clear();
+		return;
+	}
+
+	verletRadius = settings->h + settings->verletSkin;
+	verletPositions.resize(sphParticles.size());
+	buildNeighbourList(sphNeighbours, [&](uint32_t i, std::vector<uint32_t>& indices) {
+		grid.appendSPHPaticlesInRadius(sphParticles, i, verletRadius, indices);
+		verletPositions[i] = sphParticles.getPosition(i);
+	});
+
+	stats.neighbourRebuilds++;
+	stats.stepsSinceNeighbourRebuild = 0;
+}
+
+// density of i at its predicted position, plus the terrain's share in heightfield mode
+void ParticleGenerator::calculateDensity(uint32_t i, int thread)
+{
+	calculateDensities(sphParticles, i, sphNeighbours[i], *settings, threadSimdValidations[thread]);
+	if (boundaryModel != BoundaryModel::HEIGHTFIELD) return;
+
+	BoundarySample& sample = boundarySamples[i];
+	boundary.sample(terrain->getHeightfieldView(), sphParticles.getPredictedPosition(i), sample);
+	sphParticles.density[i] += settings->restDensity * boundary.getVolume(sample.distance);
+}
+
+// the boundary term of sum_j m_j grad W_ij for the pressure solvers, from the sample of the last calculateDensity
+glm::vec3 ParticleGenerator::getBoundaryGradient(uint32_t i) const
+{
+	if (boundaryModel != BoundaryModel::HEIGHTFIELD) return glm::vec3(0);
+	return boundary.getKernelGradient(boundarySamples[i], *settings);
+}
+
+// the terrain pushes back with the pressure of i, in the same form as the equation of state sweep
+glm::vec3 ParticleGenerator::calculateBoundaryPressureForce(uint32_t i) const
+{
+	if (boundaryModel != BoundaryModel::HEIGHTFIELD) return glm::vec3(0);
+	const BoundarySample& sample = boundarySamples[i];
+	float pressure = getPressureFromDensity(sphParticles.density[i], *settings);
+	return sample.normal * boundary.getPressure(sample.distance) * pressure / sphParticles.density[i] * settings->timeStep;
+}
+
+bool ParticleGenerator::sleepingEnabled() const
+{
+	return settings->particleSleeping && settings->pressureSolver == PressureSolver::EQUATION_OF_STATE;
+}
+
+// picks the particles that sleep this step. a sleeping particle wakes when a neighbour moved in the last step
+// (its still count is 0) or the last step eroded the terrain next to it, and goes back to sleep after this step
+// if it stayed still. the neighbour lists are still built for every particle, for this test
+void ParticleGenerator::updateSleeping()
+{
+	uint32_t count = (uint32_t)sphParticles.size();
+	asleep.assign(count, 0);
+	previousDensities.resize(count);
+	if (!sleepingEnabled())
+	{
+		// so turning it back on doesn't freeze particles on old counts
+		std::fill(sphParticles.stillSteps.begin(), sphParticles.stillSteps.end(), 0);
+		stats.activeParticles = count;
+		stats.sleepingParticles = 0;
+		return;
+	}
+
+	bool heightfield = boundaryModel == BoundaryModel::HEIGHTFIELD;
+	terrainChanged.resize(heightfield ? terrain->getVertexCount() : terrainParticles.size());
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+		{
+			if (sphParticles.stillSteps[i] < settings->sleepSteps) continue;
+			bool wake = false;
+			NeighbourSpan neighbours = sphNeighbours[i];
+			for (uint32_t n = 0; n < neighbours.size() && !wake; n++)
+				wake = sphParticles.stillSteps[neighbours[n]] == 0;
+			if (heightfield)
+			{
+				uint32_t vertices[4];
+				glm::vec3 position = sphParticles.getPosition(i);
+				if (terrain->getCellVertices(position.x, position.z, vertices))
+					for (uint32_t vertex : vertices)
+						wake = wake || terrainChanged[vertex] != 0;
+			}
+			else
+			{
+				NeighbourSpan boundaryParts = boundaryNeighbours[i];
+				for (uint32_t n = 0; n < boundaryParts.size() && !wake; n++)
+					wake = terrainChanged[boundaryParts[n]] != 0;
+			}
+			asleep[i] = !wake;
+		}
+	});
+
+	uint32_t sleeping = 0;
+	for (uint8_t particleAsleep : asleep)
+		sleeping += particleAsleep;
+	stats.activeParticles = count - sleeping;
+	stats.sleepingParticles = sleeping;
+}
+
+// The list is searched and checked on the current positions, the ones the grid is built from. Two particles can
+// close in by at most twice the largest displacement. The sph functions compare predicted positions, one step of
+// velocity further, the same as with the plain neighbour lists (also searched on the current positions).
+bool ParticleGenerator::verletListsValid() const
+{
+	if (verletPositions.size() != sphParticles.size()) return false;
+	if (verletRadius != settings->h + settings->verletSkin) return false;
+
+	float maxDisplacement2 = settings->verletSkin * settings->verletSkin / 4;
+	for (uint32_t i = 0; i < sphParticles.size(); i++)
+	{
+		if (glm::distance2(sphParticles.getPosition(i), verletPositions[i]) > maxDisplacement2)
+			return false;
+	}
+	return true;
+}
+
+template <typename T>
+static void reorderVector(std::vector<T>& values, const std::vector<uint32_t>& order)
+{
+	std::vector<T> reordered(values.size());
+	for (size_t i = 0; i < order.size(); i++)
+		reordered[i] = values[order[i]];
+	values.swap(reordered);
+}
+
+// Particles stay in spawn order otherwise, so once the fluid has moved the neighbours of a particle
+// are spread all over the store. Sorting by morton key of the cell puts them back next to each other.
+void ParticleGenerator::reorderParticles()
+{
+	std::vector<std::pair<uint64_t, uint32_t>> keys(sphParticles.size());
+	for (uint32_t i = 0; i < sphParticles.size(); i++)
+		keys[i] = { grid.getMortonKeyFromPosition(sphParticles.getPosition(i)), i };
+	std::sort(keys.begin(), keys.end());
+
+	std::vector<uint32_t> order(keys.size());
+	for (size_t i = 0; i < keys.size(); i++)
+		order[i] = keys[i].second;
+
+	sphParticles.reorder(order);
+	reorderVector(particleModels, order);
+	reorderVector(sphParticleDebugs, order);
+	grid.reindexSphParticles(sphParticles);
+
+	// the verlet lists refer to the old indices
+	verletPositions.clear();
+	stats.particleReorders++;
+}
+
+// tiles split [0, count) into contiguous ranges like the thread pool does
+static uint32_t getTile(uint32_t index, uint32_t count, uint32_t tileCount)
+{
+	return (uint32_t)((uint64_t)index * tileCount / count);
 }
 
 void ParticleGenerator::updateParticles(float deltaTime, float time)
 {
-	std::unordered_map <SphParticle*, std::vector<SphParticle*>> particleNeigbours;
-	std::unordered_map <SphParticle*, std::vector<TerrainParticle*>> particleBoundaryNeighbours;
+	step(deltaTime, time);
+	publishFrame(localFrame);
+	uploadFrame(localFrame);
+}
 
-	for (int i = 0; i < sphParticles.size(); i++)
+void ParticleGenerator::step(float deltaTime, float time)
+{
+	stats.steps++;
+	// h is changed directly by the ui
+	if (settings->kernels.h != settings->h)
+		settings->updateKernelConstants();
+	if (pool.getThreadCount() != settings->threadCount)
+		pool.setThreadCount(settings->threadCount);
+	if (boundaryModel == BoundaryModel::HEIGHTFIELD)
+		boundary.update(*settings);
+	if (settings->reorderInterval > 0 && stats.steps % settings->reorderInterval == 0)
+		reorderParticles();
+
+	uint32_t count = (uint32_t)sphParticles.size();
+	int threadCount = pool.getThreadCount();
+	threadSimdValidations.assign(threadCount, SimdValidationCounts());
+
+	// positions and velocities don't change until the force sweep, so one prediction serves the verlet check,
+	// the densities and the forces
+	// dfsph works on the current positions
+	sphParticles.predictPositions(settings->pressureSolver == PressureSolver::DFSPH ? 0 : settings->timeStep);
+	buildNeighbourLists();
+	updateSleeping();
+	boundarySamples.resize(count);
+
+	// the iterative solvers move the predicted positions, so they can't use cached distances
+	if (settings->cachePairDistances && settings->pressureSolver == PressureSolver::EQUATION_OF_STATE)
 	{
-		// before updating particle position
+		sphNeighbours.resizeDistances();
+		pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+			cachePairDistances(sphParticles, sphNeighbours, begin, end, *settings);
+		});
+	}
+	else
+		sphNeighbours.clearDistances();
 
-		// update particle
-		std::vector<SphParticle*> parts = grid.getNeighbouringSPHPaticlesInRadius(sphParticles[i]);
-		std::vector<TerrainParticle*> terr = grid.getNeighbouringTerrainPaticlesInRadius(sphParticles[i]);
-		std::pair<SphParticle*, std::vector<SphParticle*>> pair(sphParticles[i], parts);
-		std::pair<SphParticle*, std::vector<TerrainParticle*>> pair2(sphParticles[i], terr);
-		particleNeigbours.insert(pair);
-		particleBoundaryNeighbours.insert(pair2);
-		calculateDensity(sphParticles[i], particleNeigbours.at(sphParticles[i]), *settings);
-		calculateSedimentDensity(sphParticles[i], particleNeigbours.at(sphParticles[i]), *settings);
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+		{
+			if (asleep[i]) continue;
+			previousDensities[i] = sphParticles.density[i];
+			calculateDensity(i, thread);
+		}
+	});
+
+	threadMaxVelocityChange2.assign(threadCount, 0);
+	threadMaxSpeed2.assign(threadCount, 0);
+
+	if (settings->pressureSolver == PressureSolver::PCISPH)
+	{
+		solvePcisph();
+	}
+	else if (settings->pressureSolver == PressureSolver::DFSPH)
+	{
+		solveDfsph();
+	}
+	else if (settings->pressureSolver == PressureSolver::PBF)
+	{
+		solvePbf();
 	}
+	else if (settings->useHalfNeighbourLists)
+	{
+		if (!sphHalfNeighboursValid)
+		{
+			sphHalfNeighbours.assignHalf(sphNeighbours);
+			sphHalfNeighboursValid = true;
+		}
 
-	for (int i = 0; i < sphParticles.size(); i++)
+		// a pair adds to both particles, so a thread writes past its own range: its buffer covers its first particle
+		// up to the highest neighbour its pairs reach (j > i, and close by once the particles are sorted).
+		// only the buffers of threads that ran are summed
+		threadVelocityChanges.resize(threadCount);
+		threadVelocityChangesBegin.resize(threadCount);
+		for (std::vector<glm::vec3>& changes : threadVelocityChanges)
+			changes.clear();
+		pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+			if (begin == end) return;
+			uint32_t last = end - 1;
+			for (uint32_t i = begin; i < end; i++)
+				for (uint32_t j : sphHalfNeighbours[i])
+					last = std::max(last, j);
+			std::vector<glm::vec3>& changes = threadVelocityChanges[thread];
+			changes.assign(last + 1 - begin, glm::vec3(0));
+			threadVelocityChangesBegin[thread] = begin;
+			for (uint32_t i = begin; i < end; i++)
+				calculatePairForces(sphParticles, i, sphHalfNeighbours[i], changes.data(), begin, *settings);
+		});
+		pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+			for (uint32_t i = begin; i < end; i++)
+			{
+				// the pairs with a sleeping particle are still summed, only the awake side moves
+				if (asleep[i]) continue;
+				glm::vec3 velocityChange = calculateBoundaryPressureForce(i);
+				for (size_t t = 0; t < threadVelocityChanges.size(); t++)
+				{
+					uint32_t first = threadVelocityChangesBegin[t];
+					if (i >= first && i - first < threadVelocityChanges[t].size())
+						velocityChange += threadVelocityChanges[t][i - first];
+				}
+				sphParticles.setVelocity(i, sphParticles.getVelocity(i) + velocityChange);
+				threadMaxVelocityChange2[thread] = std::max(threadMaxVelocityChange2[thread], glm::length2(velocityChange));
+			}
+		});
+	}
+	else
 	{
 		// before updating particle position
-		calculatePressureForce(sphParticles[i], particleNeigbours.at(sphParticles[i]), *settings);
-
-		calculateSufaceTension(sphParticles[i], particleNeigbours.at(sphParticles[i]), *settings);
-		calculateViscosity(sphParticles[i], particleNeigbours.at(sphParticles[i]), *settings);
+		velocityChanges.resize(count);
+		pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+			for (uint32_t i = begin; i < end; i++)
+				velocityChanges[i] = asleep[i] ? glm::vec3(0) : calculateForces(sphParticles, i, sphNeighbours[i], *settings, threadSimdValidations[thread]) + calculateBoundaryPressureForce(i);
+		});
+		pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+			for (uint32_t i = begin; i < end; i++)
+			{
+				sphParticles.setVelocity(i, sphParticles.getVelocity(i) + velocityChanges[i]);
+				threadMaxVelocityChange2[thread] = std::max(threadMaxVelocityChange2[thread], glm::length2(velocityChanges[i]));
+			}
+		});
 	}
 
 
@@ -199,151 +508,252 @@ void ParticleGenerator::updateParticles(float deltaTime, float time)
 	float K = 0.0025;
 	// critical shear val
 	float shearCrit = 2;
-	for (int i = 0; i < sphParticles.size(); i++)
-	{
-		SphParticle* particle = sphParticles[i];
-		std::vector<TerrainParticle*> boundaryParts = particleBoundaryNeighbours.at(sphParticles[i]);
-		for (int j = 0; j < boundaryParts.size(); j++)
+	// gather: taking the sediment only touches the fluid particle, the terrain changes are binned by tile.
+	// reduce: each tile is applied by one thread, from the buffers in thread order, so every vertex and terrain
+	// particle sees its changes in particle order whatever the thread count.
+	uint32_t tileCount = (uint32_t)threadCount;
+	const Heightfield& heights = terrain->getHeightfield();
+	uint32_t heightTileCount = (uint32_t)heights.getTileCount();
+	uint32_t vertexCount = terrain->getVertexCount();
+	uint32_t terrainCount = (uint32_t)terrainParticles.size();
+	threadErosion.resize(threadCount);
+	for (ErosionBuffer& buffer : threadErosion)
+		buffer.clear(heightTileCount, tileCount);
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		ErosionBuffer& buffer = threadErosion[thread];
+		std::vector<HeightDelta> deltas;
+		for (uint32_t i = begin; i < end; i++)
 		{
-			Cell* startCell = grid.getCellFromPosition(boundaryParts[j]->getPosition());
-			glm::vec3 ab = particle->getPosition() - boundaryParts[j]->getPosition();
-			float shearRate = powf(glm::length(particle->getVelocity()) / glm::distance(particle->getPosition(), boundaryParts[j]->getPosition()), 0.5f);
-			float erosionRate = K * (shearRate - shearCrit) * settings->timeStep;			
-
-			float removeAmount = sphParticles[i]->takeSediment(erosionRate);
-			terrain->modify_height(boundaryParts[j]->getPosition().x, boundaryParts[j]->getPosition().z, -removeAmount);
-			boundaryParts[j]->setPosition(boundaryParts[j]->getPosition() - glm::vec3(0, removeAmount, 0));
-			Cell* endCell = grid.getCellFromPosition(boundaryParts[j]->getPosition());
-			// std::cout<< shearRate << std::endl;
+			if (asleep[i]) continue;
+			glm::vec3 position = sphParticles.getPosition(i);
+			glm::vec3 velocity = sphParticles.getVelocity(i);
 
+			// one erosion at the terrain under the particle, from the distance to it instead of to terrain particles
+			if (boundaryModel == BoundaryModel::HEIGHTFIELD)
+			{
+				BoundarySample sample;
+				boundary.sample(terrain->getHeightfieldView(), position, sample);
+				if (sample.distance >= settings->h) continue;
+				float shearRate = powf(glm::length(velocity) / std::max(sample.distance, sphParticles.getRadius()), 0.5f);
+				float erosionRate = K * (shearRate - shearCrit) * settings->timeStep;
+				float removeAmount = sphParticles.takeSediment(i, erosionRate);
+
+				deltas.clear();
+				terrain->gatherHeightDeltas(position.x, position.z, -removeAmount, deltas);
+				for (const HeightDelta& delta : deltas)
+					buffer.heightDeltas[heights.getTileOfVertex(delta.vertex)].push_back(delta);
+				continue;
+			}
 
-			if (startCell != endCell)
+			NeighbourSpan boundaryParts = boundaryNeighbours[i];
+			for (uint32_t j = 0; j < boundaryParts.size(); j++)
 			{
-				if (startCell != nullptr)
-					startCell->removeTerrainParticle(boundaryParts[j]);
-				if (endCell != nullptr)
-					endCell->addTerrainParticle(boundaryParts[j]);
+				TerrainParticle* boundaryPart = terrainParticles[boundaryParts[j]];
+				float shearRate = powf(glm::length(velocity) / glm::distance(position, boundaryPart->getPosition()), 0.5f);
+				float erosionRate = K * (shearRate - shearCrit) * settings->timeStep;
+
+				float removeAmount = sphParticles.takeSediment(i, erosionRate);
+				buffer.terrainParticles[getTile(boundaryParts[j], terrainCount, tileCount)].push_back({ boundaryParts[j], removeAmount });
+
+				deltas.clear();
+				terrain->gatherHeightDeltas(boundaryPart->getPosition().x, boundaryPart->getPosition().z, -removeAmount, deltas);
+				for (const HeightDelta& delta : deltas)
+					buffer.heightDeltas[heights.getTileOfVertex(delta.vertex)].push_back(delta);
+				// std::cout<< shearRate << std::endl;
 			}
 		}
+	});
 
-		std::vector<SphParticle*> neighbours = particleNeigbours.at(sphParticles[i]);
-		float fC = particle->getSedimentVolume() <= settings->sedimentSaturation ? (1 - powf(particle->getSedimentVolume() / settings->sedimentSaturation, 4.5)) : 0;
-		glm::vec3 settlingVelo = particle->getVelocity() + glm::vec3(0, settings->g, 0) * settings->timeStep;
-		
-		// std::cout << settlingVelo.x << " " << settlingVelo.y << " " << settlingVelo.z << std::endl;
-		
-		float diffusion = 0;
-		float transfer = 0;
-		for (int j = 0; j < neighbours.size(); j++)
+	terrainMigrations.resize(tileCount);
+	bool heightfield = boundaryModel == BoundaryModel::HEIGHTFIELD;
+	terrainChanged.assign(heightfield ? vertexCount : terrainCount, 0);
+	pool.parallelFor(heightTileCount, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t tile = begin; tile < end; tile++)
 		{
-			glm::vec3 ab = neighbours[j]->getPosition() - particle->getPosition();
-			float length = glm::length(ab);
-			glm::vec3 abNorm = ab / length;
-
-			float dotDir = glm::dot(settlingVelo, ab);
-			float amt = 0;
-			
-			//doesnt work idk why
-			// donor
-			if (dotDir >= 0) 
+			for (const ErosionBuffer& buffer : threadErosion)
+				for (const HeightDelta& delta : buffer.heightDeltas[tile])
+				{
+					terrain->applyHeightDelta(delta);
+					if (heightfield && delta.amount != 0)
+						terrainChanged[delta.vertex] = 1;
+				}
+		}
+	});
+	pool.parallelFor(tileCount, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t tile = begin; tile < end; tile++)
+		{
+			std::vector<CellMigration>& migrations = terrainMigrations[tile];
+			migrations.clear();
+			for (const ErosionBuffer& buffer : threadErosion)
 			{
-				//if (neighbours[j]->getSediment() >= settings->sedimentSaturation || particle->getSediment() <= 0) continue;
-				amt = neighbours[j]->mass * neighbours[j]->getSedimentVolume() / neighbours[j]->getDensity() * glm::dot(settlingVelo, abNorm) * kernelFuncSpiky3(settings->h, length);
-				//neighbours[j]->setSediment(neighbours[j]->getSediment() + amt);
+				for (const TerrainErosion& erosion : buffer.terrainParticles[tile])
+				{
+					TerrainParticle* boundaryPart = terrainParticles[erosion.terrainParticle];
+					if (erosion.amount != 0)
+						terrainChanged[erosion.terrainParticle] = 1;
+					glm::vec3 startPosition = boundaryPart->getPosition();
+					boundaryPart->setPosition(startPosition - glm::vec3(0, erosion.amount, 0));
+					if (grid.getCellKeyFromPosition(startPosition) != grid.getCellKeyFromPosition(boundaryPart->getPosition()))
+						migrations.push_back({ erosion.terrainParticle, startPosition, boundaryPart->getPosition() });
+				}
 			}
-			// acceptor
-			else
+		}
+	});
+	for (const std::vector<CellMigration>& migrations : terrainMigrations)
+		grid.moveTerrainParticles(migrations);
+
+	// 2. sediment diffusion, from the sediment after erosion, applied once every particle has been done
+	sedimentChanges.resize(count);
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+		{
+			if (asleep[i])
 			{
-				//if (particle->getSediment() >= settings->sedimentSaturation || neighbours[j]->getSediment() <= 0) continue;
-				amt = particle->mass * particle->getSedimentVolume() / particle->getDensity() * glm::dot(settlingVelo, abNorm) * kernelFuncSpiky3(settings->h, length);
-				//particle->setSediment(particle->getSediment() + amt);
+				sedimentChanges[i] = 0;
+				continue;
 			}
+			glm::vec3 position = sphParticles.getPosition(i);
+			glm::vec3 velocity = sphParticles.getVelocity(i);
+			NeighbourSpan neighbours = sphNeighbours[i];
+			float sedimentVolume = sphParticles.getSedimentVolume(i);
+			float fC = sedimentVolume <= settings->sedimentSaturation ? (1 - powf(sedimentVolume / settings->sedimentSaturation, 4.5)) : 0;
+			glm::vec3 settlingVelo = velocity + glm::vec3(0, settings->g, 0) * settings->timeStep;
+		
+			// std::cout << settlingVelo.x << " " << settlingVelo.y << " " << settlingVelo.z << std::endl;
+		
+			float diffusion = 0;
+			float transfer = 0;
+			for (uint32_t n = 0; n < neighbours.size(); n++)
+			{
+				uint32_t j = neighbours[n];
+				glm::vec3 ab = sphParticles.getPosition(j) - position;
+				float length = glm::length(ab);
+				glm::vec3 abNorm = ab / length;
 
-			transfer -= amt;
-			diffusion -= neighbours[j]->mass / (particle->getDensity() * neighbours[j]->getDensity()) * 10.f * (particle->getSedimentVolume() - neighbours[j]->getSedimentVolume()) * kernelFuncSpiky3(settings->h, glm::distance(particle->getPosition(), neighbours[j]->getPosition()));
+				float dotDir = glm::dot(settlingVelo, ab);
+				float amt = 0;
+			
+				//doesnt work idk why
+				// donor
+				if (dotDir >= 0) 
+				{
+					//if (neighbours[j]->getSediment() >= settings->sedimentSaturation || particle->getSediment() <= 0) continue;
+					amt = sphParticles.mass[j] * sphParticles.getSedimentVolume(j) / sphParticles.density[j] * glm::dot(settlingVelo, abNorm) * SpikyKernel::value(*settings, length, length * length);
+					//neighbours[j]->setSediment(neighbours[j]->getSediment() + amt);
+				}
+				// acceptor
+				else
+				{
+					//if (particle->getSediment() >= settings->sedimentSaturation || neighbours[j]->getSediment() <= 0) continue;
+					amt = sphParticles.mass[i] * sedimentVolume / sphParticles.density[i] * glm::dot(settlingVelo, abNorm) * SpikyKernel::value(*settings, length, length * length);
+					//particle->setSediment(particle->getSediment() + amt);
+				}
+
+				transfer -= amt;
+				diffusion -= sphParticles.mass[j] / (sphParticles.density[i] * sphParticles.density[j]) * 10.f * (sedimentVolume - sphParticles.getSedimentVolume(j)) * SpikyKernel::value(*settings, length, length * length);
 			
+			}
+			//std::cout << transfer * settings->timeStep << std::endl;
+			//std::cout << "FC" << fC << std::endl;
+			//std::cout << particle->getSediment() << std::endl;
+
+			//std::cout << particle->getSedimentDensity() << std::endl;
+			//if (particle->getSediment() > 0)
+			//std::cout << diffusion << std::endl;
+			sedimentChanges[i] = diffusion * settings->timeStep;
 		}
-		//std::cout << transfer * settings->timeStep << std::endl;
-		//std::cout << "FC" << fC << std::endl;
-		//std::cout << particle->getSediment() << std::endl;
-
-		//std::cout << particle->getSedimentDensity() << std::endl;
-		//if (particle->getSediment() > 0)
-		//std::cout << diffusion << std::endl;
-		particle->setSediment(particle->getSediment() + ((diffusion) * settings->timeStep));
+	});
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+			sphParticles.sediment[i] += sedimentChanges[i];
+	});
+	// the explicit diffusion overshoots at the larger steps the pressure solvers allow
+	if (settings->pressureSolver != PressureSolver::EQUATION_OF_STATE)
+		sphParticles.clampSedimentConserved();
+
+	stats.simdValidations = 0;
+	stats.simdMismatches = 0;
+	for (const SimdValidationCounts& validation : threadSimdValidations)
+	{
+		stats.simdValidations += validation.checked;
+		stats.simdMismatches += validation.mismatched;
 	}
 
-	// update the positions and collide
-	for (int i = 0; i < sphParticles.size(); i++)
-	{
-		SphParticle* sphParticle = sphParticles[i];
-		Cell* previousCell = grid.getCellFromPosition(sphParticles[i]->getPosition());
-		glm::vec3 acceleration = glm::vec3(0, settings->g, 0);
+	// update the positions and collide, the particles that changed cell are moved in the grid after
+	threadMigrations.resize(threadCount);
+	for (std::vector<CellMigration>& migrations : threadMigrations)
+		migrations.clear();
+	TerrainCollision collision = { terrain->getHeightfieldView(), sphParticles.getRadius(), (float)_heightmap->getMinHeight(), _heightmap->getMaxHeight() - 1.0f };
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		std::vector<CellMigration>& migrations = threadMigrations[thread];
+		glm::vec3 previousPositions[collisionBlockSize];
+		// a block at a time, so the block is still in cache for the terrain collision and the pass after it
+		for (uint32_t blockBegin = begin; blockBegin < end; blockBegin += collisionBlockSize)
+		{
+			uint32_t blockEnd = std::min(end, blockBegin + collisionBlockSize);
+			for (uint32_t i = blockBegin; i < blockEnd; i++)
+			{
+				if (asleep[i]) continue;
+				previousPositions[i - blockBegin] = sphParticles.getPosition(i);
+				glm::vec3 acceleration = glm::vec3(0, settings->g, 0);
 
-		sphParticles[i]->setVelocity(sphParticles[i]->getVelocity() + (acceleration) * settings->timeStep);
-		sphParticles[i]->setPosition(sphParticles[i]->getPosition() + sphParticles[i]->getVelocity() * settings->timeStep);
+				sphParticles.setVelocity(i, sphParticles.getVelocity(i) + (acceleration) * settings->timeStep);
+				sphParticles.setPosition(i, sphParticles.getPosition(i) + sphParticles.getVelocity(i) * settings->timeStep);
 
 
-		glm::vec3 pos = sphParticle->getPosition();
-		glm::vec3 vel = sphParticle->getVelocity();
-		float rad = sphParticle->getRadius();
+				glm::vec3 pos = sphParticles.getPosition(i);
+				glm::vec3 vel = sphParticles.getVelocity(i);
+				float rad = sphParticles.getRadius();
 
-		if (pos.x - rad < _heightmap->getMinX() || pos.x + rad >= _heightmap->getMaxX() - 1) {
-			sphParticle->setPosition(glm::vec3(pos.x - rad < _heightmap->getMinX() ? _heightmap->getMinX() + rad : _heightmap->getMaxX() - 1 - rad, pos.y, pos.z));
-			sphParticle->setVelocity(glm::vec3(-vel.x * 0.05f, vel.y, vel.z));
-		}
+				if (pos.x - rad < _heightmap->getMinX() || pos.x + rad >= _heightmap->getMaxX() - 1) {
+					sphParticles.setPosition(i, glm::vec3(pos.x - rad < _heightmap->getMinX() ? _heightmap->getMinX() + rad : _heightmap->getMaxX() - 1 - rad, pos.y, pos.z));
+					sphParticles.setVelocity(i, glm::vec3(-vel.x * 0.05f, vel.y, vel.z));
+				}
 
-		pos = sphParticle->getPosition();
-		vel = sphParticle->getVelocity();
-		if (pos.z - rad < _heightmap->getMinZ() || pos.z + rad >= _heightmap->getMaxZ() - 1) {
-			sphParticle->setPosition(glm::vec3(pos.x, pos.y, pos.z - rad < _heightmap->getMinZ() ? _heightmap->getMinZ() + rad : _heightmap->getMaxZ() - 1 - rad));
-			sphParticle->setVelocity(glm::vec3(vel.x, vel.y, -vel.z * 0.05f));
-		}
+				pos = sphParticles.getPosition(i);
+				vel = sphParticles.getVelocity(i);
+				if (pos.z - rad < _heightmap->getMinZ() || pos.z + rad >= _heightmap->getMaxZ() - 1) {
+					sphParticles.setPosition(i, glm::vec3(pos.x, pos.y, pos.z - rad < _heightmap->getMinZ() ? _heightmap->getMinZ() + rad : _heightmap->getMaxZ() - 1 - rad));
+					sphParticles.setVelocity(i, glm::vec3(vel.x, vel.y, -vel.z * 0.05f));
+				}
+			}
 
+			// if the particle is below the terrain, bring it back.
+			collideWithTerrain(collision, sphParticles, blockBegin, blockEnd, asleep.data(), *settings);
 
-		pos = sphParticle->getPosition();
-		vel = sphParticle->getVelocity();
-		// if the particle is below the terrain, bring it back.
-		// UNCOMMENT BELOW
-		float terrainHeightAtPosition = terrain->sampleHeightAtPosition(pos.x, pos.z);
-		if (pos.y - rad <= terrainHeightAtPosition) {
-			glm::vec3 normal = terrain->sampleWeightedNormalAtPosition(pos.x, pos.z);
-			float yStrength = std::clamp(glm::dot(normal, glm::normalize(sphParticle->getVelocity())), 0.05f, 0.95f);
-			sphParticles[i]->setPosition(glm::vec3(pos.x, terrainHeightAtPosition + rad, pos.z));
-			glm::vec3 newVel = glm::reflect(sphParticle->getVelocity(), normal);
-			sphParticle->setVelocity(glm::vec3(newVel.x * 0.95f, newVel.y * yStrength, newVel.z * 0.95f));
-			// sphParticle->setVelocity(glm::vec3(vel.x, -vel.y * 0.2, vel.z));
-		}
-		else if (pos.y - rad <= _heightmap->getMinHeight())
-		{
-			sphParticle->setPosition(glm::vec3(pos.x, _heightmap->getMinHeight() + rad, pos.z));
-			sphParticle->setVelocity(glm::vec3(vel.x * 0.5f, -vel.y * 0.05, vel.z * 0.5));
-		}
-		else if (sphParticle->getPosition().y + rad > _heightmap->getMaxHeight() - 1)
-		{
-			sphParticle->setPosition(glm::vec3(pos.x, _heightmap->getMaxHeight() - 1 - rad - 0.001, pos.z));
-			sphParticle->setVelocity(glm::vec3(vel.x * 0.5f, -vel.y * 0.05, vel.z * 0.5));
+			for (uint32_t i = blockBegin; i < blockEnd; i++)
+			{
+				if (asleep[i]) continue;
+				// Update position
+				particleModels[i] = glm::translate(glm::mat4(1.0), sphParticles.getPosition(i));
+				// search for neighbours
+
+				glm::vec3 previousPosition = previousPositions[i - blockBegin];
+				if (grid.getCellKeyFromPosition(previousPosition) != grid.getCellKeyFromPosition(sphParticles.getPosition(i)))
+					migrations.push_back({ i, previousPosition, sphParticles.getPosition(i) });
+				threadMaxSpeed2[thread] = std::max(threadMaxSpeed2[thread], glm::length2(sphParticles.getVelocity(i)));
+
+				if (sleepingEnabled())
+				{
+					bool still = glm::length2(sphParticles.getVelocity(i)) < settings->sleepSpeed * settings->sleepSpeed
+						&& fabsf(sphParticles.density[i] - previousDensities[i]) < settings->sleepDensityChange * settings->restDensity;
+					int& stillSteps = sphParticles.stillSteps[i];
+					stillSteps = still ? std::min(stillSteps + 1, settings->sleepSteps) : 0;
+					// falls asleep at rest
+					if (stillSteps == settings->sleepSteps)
+						sphParticles.setVelocity(i, glm::vec3(0));
+				}
+			}
 		}
+	});
+	for (const std::vector<CellMigration>& migrations : threadMigrations)
+		grid.moveSphParticles(migrations);
 
-		// Update position
-		particleModels[i] = glm::translate(glm::mat4(1.0), sphParticle->getPosition());
-		// search for neighbours
-
-		//after updating particle position
-		Cell* currentCell = grid.getCellFromPosition(sphParticle->getPosition());
-		if (previousCell != currentCell)
-		{
-			if (previousCell != nullptr)
-				previousCell->removeSphParticle(sphParticle);
-			if (currentCell != nullptr)
-				currentCell->addSphParticle(sphParticle);
-		}
-	}
-
-	
-
-
-
+	// the sph forces plus gravity, collisions are left out
+	stats.timeStep = settings->timeStep;
+	stats.maxSpeed = sqrtf(*std::max_element(threadMaxSpeed2.begin(), threadMaxSpeed2.end()));
+	stats.maxAcceleration = sqrtf(*std::max_element(threadMaxVelocityChange2.begin(), threadMaxVelocityChange2.end())) / settings->timeStep
+		+ fabsf(settings->g);
 
 	for (int i = 0; i < terrainParticles.size(); i++) {
 		particleModelsTerrain[i] = glm::translate(glm::mat4(1), terrainParticles[i]->getPosition());
@@ -353,8 +763,8 @@ void ParticleGenerator::updateParticles(float deltaTime, float time)
 	{		
 		sphParticleDebugs[i].isNearestNeighbour = false;
 		sphParticleDebugs[i].isNearestNeighbourTarget = false;
-		sphParticleDebugs[i].linearVelocity = glm::length2(sphParticles[i]->getVelocity());
-		sphParticleDebugs[i].sediment = sphParticles[i]->getSediment();
+		sphParticleDebugs[i].linearVelocity = glm::length2(sphParticles.getVelocity(i));
+		sphParticleDebugs[i].sediment = sphParticles.sediment[i];
 		// std::cout << sphParticles[i]->getSediment() << std::endl;
 	}
 
@@ -363,33 +773,299 @@ void ParticleGenerator::updateParticles(float deltaTime, float time)
 		particles[0]->getId(),
 		node->particle->getPosition().x, node->particle->getPosition().y, node->particle->getPosition().z,
 		node->particle->getId());*/
+}
 
-		// update the models buffer
-	glBindBuffer(GL_ARRAY_BUFFER, sphBuffer);
-	void* data = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-	memcpy(data, particleModels.data(), sizeof(particleModels[0]) * particleModels.size());
-	glUnmapBuffer(GL_ARRAY_BUFFER);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+// see pcisph.h. uses the full neighbour lists, also in half list mode
+void ParticleGenerator::solvePcisph()
+{
+	uint32_t count = (uint32_t)sphParticles.size();
+	float delta = calculatePcisphDelta(*settings);
+	nonPressureVelocityChanges.resize(count);
+	velocityChanges.assign(count, glm::vec3(0));
+	densityErrors.resize(count);
+	sphParticles.pressure.assign(count, 0);
+
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+			nonPressureVelocityChanges[i] = calculateNonPressureForces(sphParticles, i, sphNeighbours[i], *settings);
+	});
+
+	int iteration = 0;
+	float densityError = 0;
+	while (iteration < settings->maxPressureIterations)
+	{
+		pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+			for (uint32_t i = begin; i < end; i++)
+				predictPosition(sphParticles, i, nonPressureVelocityChanges[i] + velocityChanges[i], *settings);
+		});
+		pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+			for (uint32_t i = begin; i < end; i++)
+			{
+				calculateDensity(i, thread);
+				densityErrors[i] = correctPcisphPressure(sphParticles, i, delta, *settings);
+			}
+		});
+		pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+			for (uint32_t i = begin; i < end; i++)
+				velocityChanges[i] = calculatePcisphPressureForces(sphParticles, i, sphNeighbours[i], getBoundaryGradient(i), *settings);
+		});
+		iteration++;
+
+		// summed in particle order, so the iteration count doesn't depend on the thread count
+		densityError = 0;
+		for (uint32_t i = 0; i < count; i++)
+			densityError += densityErrors[i];
+		densityError = count > 0 ? densityError / count : 0;
+		if (iteration >= settings->minPressureIterations && densityError <= settings->pressureTolerance)
+			break;
+	}
+	stats.pressureIterations = iteration;
+	stats.densityError = densityError;
 
-	// update the models buffer
-	glBindBuffer(GL_ARRAY_BUFFER, terrainParticlesBuffer);
-	void* terrainData = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-	memcpy(terrainData, particleModelsTerrain.data(), sizeof(particleModelsTerrain[0]) * particleModelsTerrain.size());
-	glUnmapBuffer(GL_ARRAY_BUFFER);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+		{
+			glm::vec3 velocityChange = nonPressureVelocityChanges[i] + velocityChanges[i];
+			sphParticles.setVelocity(i, sphParticles.getVelocity(i) + velocityChange);
+			threadMaxVelocityChange2[thread] = std::max(threadMaxVelocityChange2[thread], glm::length2(velocityChange));
+		}
+	});
+}
 
-	// update the debug buffer
-	glBindBuffer(GL_ARRAY_BUFFER, sphDebugBuffer);
-	void* debugData = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-	memcpy(debugData, sphParticleDebugs.data(), sizeof(SPHParticleDebug) * sphParticleDebugs.size());
-	glUnmapBuffer(GL_ARRAY_BUFFER);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+// see dfsph.h. like pcisph, uses the full neighbour lists in half list mode too
+void ParticleGenerator::solveDfsph()
+{
+	uint32_t count = (uint32_t)sphParticles.size();
+	float dt = settings->timeStep;
+	dfsphFactors.resize(count);
+	dfsphStiffness.resize(count);
+	velocityCorrections.resize(count);
+	velocityChanges.assign(count, glm::vec3(0));
+	densityErrors.resize(count);
+
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+			dfsphFactors[i] = calculateDfsphFactor(sphParticles, i, sphNeighbours[i], getBoundaryGradient(i), *settings);
+	});
+
+	// only compression is corrected, and only where the particle is at least at rest density. particles short of
+	// neighbours (the free surface) are left to the density solver, correcting their divergence blows up
+	stats.divergenceIterations = runDfsphSolver(sphParticles.divergenceStiffness, settings->divergenceTolerance,
+		[&](uint32_t i, float densityChange, float& error) {
+			densityChange = sphParticles.density[i] < settings->restDensity ? 0 : std::max(0.0f, densityChange);
+			error = densityChange * dt / settings->restDensity;
+			return densityChange / dt * dfsphFactors[i];
+		}, stats.divergenceError);
+
+	nonPressureVelocityChanges.resize(count);
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+			nonPressureVelocityChanges[i] = calculateNonPressureForces(sphParticles, i, sphNeighbours[i], *settings);
+	});
+	// the density solve has to see gravity too, the integration adds it again after so it is taken back out below
+	glm::vec3 gravity = glm::vec3(0, settings->g, 0) * dt;
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+		{
+			sphParticles.setVelocity(i, sphParticles.getVelocity(i) + nonPressureVelocityChanges[i] + gravity);
+			velocityChanges[i] += nonPressureVelocityChanges[i];
+		}
+	});
+
+	// density at the end of the step if the velocities were left as they are
+	stats.pressureIterations = runDfsphSolver(sphParticles.densityStiffness, settings->pressureTolerance,
+		[&](uint32_t i, float densityChange, float& error) {
+			float densityError = std::max(0.0f, sphParticles.density[i] + dt * densityChange - settings->restDensity);
+			error = densityError / settings->restDensity;
+			return densityError / (dt * dt) * dfsphFactors[i];
+		}, stats.densityError);
+
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+		{
+			sphParticles.setVelocity(i, sphParticles.getVelocity(i) - gravity);
+			threadMaxVelocityChange2[thread] = std::max(threadMaxVelocityChange2[thread], glm::length2(velocityChanges[i]));
+		}
+	});
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, terrainParticlesDebugBuffer);
-	void* boundaryDebugData = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-	memcpy(boundaryDebugData, boundaryParticleDebugs.data(), sizeof(boundaryParticleDebugs[0]) * boundaryParticleDebugs.size());
-	glUnmapBuffer(GL_ARRAY_BUFFER);
+// see pbf.h. the velocity change is the one that makes the integration below land on the corrected position,
+// the collisions are left to it
+void ParticleGenerator::solvePbf()
+{
+	uint32_t count = (uint32_t)sphParticles.size();
+	float dt = settings->timeStep;
+	nonPressureVelocityChanges.resize(count);
+	positionCorrections.resize(count);
+	densityErrors.resize(count);
+	sphParticles.pressure.assign(count, 0);
+
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+			nonPressureVelocityChanges[i] = calculateNonPressureForces(sphParticles, i, sphNeighbours[i], *settings);
+	});
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+			predictPosition(sphParticles, i, nonPressureVelocityChanges[i], *settings);
+	});
+
+	for (int iteration = 0; iteration < settings->pbfIterations; iteration++)
+	{
+		pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+			for (uint32_t i = begin; i < end; i++)
+			{
+				calculateDensity(i, thread);
+				densityErrors[i] = calculatePbfLambda(sphParticles, i, sphNeighbours[i], getBoundaryGradient(i), *settings);
+			}
+		});
+		pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+			for (uint32_t i = begin; i < end; i++)
+				positionCorrections[i] = calculatePbfPositionCorrection(sphParticles, i, sphNeighbours[i], getBoundaryGradient(i), *settings);
+		});
+		pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+			for (uint32_t i = begin; i < end; i++)
+				sphParticles.setPredictedPosition(i, sphParticles.getPredictedPosition(i) + positionCorrections[i]);
+		});
+	}
+
+	// error before the last correction, summed in particle order
+	float densityError = 0;
+	for (uint32_t i = 0; i < count; i++)
+		densityError += densityErrors[i];
+	stats.pressureIterations = settings->pbfIterations;
+	stats.densityError = count > 0 && settings->pbfIterations > 0 ? densityError / count : 0;
+
+	glm::vec3 gravity = glm::vec3(0, settings->g, 0) * dt;
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+		{
+			glm::vec3 velocity = sphParticles.getVelocity(i);
+			glm::vec3 velocityChange = (sphParticles.getPredictedPosition(i) - sphParticles.getPosition(i)) / dt - velocity - gravity;
+			sphParticles.setVelocity(i, velocity + velocityChange);
+			threadMaxVelocityChange2[thread] = std::max(threadMaxVelocityChange2[thread], glm::length2(velocityChange));
+		}
+	});
+}
+
+// stiffnessOf(i, densityChange, error) returns the stiffness of i for this iteration and sets its error
+template <typename Stiffness>
+int ParticleGenerator::runDfsphSolver(AlignedVector<float>& storedStiffness, float tolerance, Stiffness stiffnessOf, float& error)
+{
+	uint32_t count = (uint32_t)sphParticles.size();
+
+	// warm start from half of the stiffness of the last step, only where the solver still has something to correct,
+	// a particle that stopped being compressed would otherwise keep getting pushed
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+		{
+			float densityChange = calculateDensityChange(sphParticles, i, sphNeighbours[i], getBoundaryGradient(i), *settings);
+			stiffnessOf(i, densityChange, densityErrors[i]);
+			dfsphStiffness[i] = densityErrors[i] > 0 ? 0.5f * storedStiffness[i] : 0;
+		}
+	});
+	std::copy(dfsphStiffness.begin(), dfsphStiffness.end(), storedStiffness.begin());
+	applyDfsphCorrection();
+
+	int iteration = 0;
+	error = 0;
+	while (iteration < settings->maxPressureIterations)
+	{
+		pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+			for (uint32_t i = begin; i < end; i++)
+			{
+				float densityChange = calculateDensityChange(sphParticles, i, sphNeighbours[i], getBoundaryGradient(i), *settings);
+				dfsphStiffness[i] = stiffnessOf(i, densityChange, densityErrors[i]);
+				storedStiffness[i] += dfsphStiffness[i];
+			}
+		});
+		applyDfsphCorrection();
+		iteration++;
+
+		// summed in particle order, so the iteration count doesn't depend on the thread count
+		error = 0;
+		for (uint32_t i = 0; i < count; i++)
+			error += densityErrors[i];
+		error = count > 0 ? error / count : 0;
+		if (iteration >= settings->minPressureIterations && error <= tolerance)
+			break;
+	}
+	return iteration;
+}
+
+// corrections from dfsphStiffness, all computed before any velocity changes
+void ParticleGenerator::applyDfsphCorrection()
+{
+	uint32_t count = (uint32_t)sphParticles.size();
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+			velocityCorrections[i] = calculateDfsphVelocityCorrection(sphParticles, i, sphNeighbours[i], dfsphStiffness.data(), getBoundaryGradient(i), *settings);
+	});
+	pool.parallelFor(count, [&](uint32_t begin, uint32_t end, int thread) {
+		for (uint32_t i = begin; i < end; i++)
+		{
+			sphParticles.setVelocity(i, sphParticles.getVelocity(i) + velocityCorrections[i]);
+			velocityChanges[i] += velocityCorrections[i];
+		}
+	});
+}
+
+float ParticleGenerator::getStableTimeStep(float maxTimeStep) const
+{
+	float timeStep = maxTimeStep;
+	if (stats.maxSpeed > 0)
+		timeStep = std::min(timeStep, settings->cflNumber * settings->h / stats.maxSpeed);
+	if (stats.maxAcceleration > 0)
+		timeStep = std::min(timeStep, settings->forceNumber * sqrtf(settings->h / stats.maxAcceleration));
+	return std::max(timeStep, std::min(settings->minTimeStep, maxTimeStep));
+}
+
+void ParticleGenerator::publishFrame(SimulationFrame& frame) const
+{
+	frame.particleModels = particleModels;
+	frame.sphParticleDebugs = sphParticleDebugs;
+	frame.terrainParticleModels = particleModelsTerrain;
+	frame.boundaryParticleDebugs = boundaryParticleDebugs;
+
+	// only the tiles eroded since this frame buffer was last published
+	std::vector<uint32_t> copiedTiles;
+	frame.terrainHeights.copyChangedTiles(terrain->getHeightfield(), copiedTiles);
+
+	frame.gridCells.clear();
+	if (grid.getMode() == GridMode::HASHED)
+		grid.getOccupiedCells(frame.gridCells);
+	frame.stats = stats;
+}
+
+// replaces the whole buffer when the size changed, maps it otherwise
+template <typename T>
+static void uploadBuffer(uint32_t buffer, const std::vector<T>& values, size_t drawnCount)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	if (values.size() != drawnCount)
+	{
+		glBufferData(GL_ARRAY_BUFFER, values.size() * sizeof(T), values.data(), GL_DYNAMIC_DRAW);
+	}
+	else
+	{
+		void* data = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+		memcpy(data, values.data(), sizeof(T) * values.size());
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ParticleGenerator::uploadFrame(const SimulationFrame& frame)
+{
+	// update the models and debug buffers, particles added since the last upload grow them
+	uploadBuffer(sphBuffer, frame.particleModels, drawnParticleCount);
+	uploadBuffer(sphDebugBuffer, frame.sphParticleDebugs, drawnParticleCount);
+	drawnParticleCount = frame.particleModels.size();
+
+	uploadBuffer(terrainParticlesBuffer, frame.terrainParticleModels, drawnTerrainParticleCount);
+	uploadBuffer(terrainParticlesDebugBuffer, frame.boundaryParticleDebugs, drawnTerrainParticleCount);
+	drawnTerrainParticleCount = frame.terrainParticleModels.size();
+
+	drawnGridCells = frame.gridCells;
 
 	//particleMesh->update();
 }
@@ -398,7 +1074,7 @@ void ParticleGenerator::addParticles(glm::vec3 pos, float radius, float intensit
 {
 	int rad = (int)radius;
 	int intens = (int)intensity;
-	std::vector<SphParticle*> parts;
+	std::vector<uint32_t> parts;
 	for (int x = -rad * intensity; x < rad * intensity; x++)
 	{
 		for (int y = 0; y < rad * intensity; y++) {
@@ -409,68 +1085,20 @@ void ParticleGenerator::addParticles(glm::vec3 pos, float radius, float intensit
 					(float)x * grid.cellSize,
 					(float)y * grid.cellSize + rad,
 					(float)z * grid.cellSize);
-				SphParticle* sphPart = new SphParticle(pos + position, 0.05);
+				uint32_t sphPart = sphParticles.add(pos + position);
 				parts.push_back(sphPart);
-				particleModels.push_back(glm::translate(glm::mat4(1), sphPart->getPosition()));
+				particleModels.push_back(glm::translate(glm::mat4(1), sphParticles.getPosition(sphPart)));
 				sphParticleDebugs.push_back(SPHParticleDebug());				
 			}
 		}
 	}
 
-	sphParticles.insert(sphParticles.end(), parts.begin(), parts.end());
-	glBindVertexArray(particleMesh->getVAO());
-
-	glGenBuffers(1, &sphBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, sphBuffer);
-	glBufferData(GL_ARRAY_BUFFER, particleModels.size() * sizeof(glm::mat4), particleModels.data(), GL_DYNAMIC_DRAW);
-
-	// set attribute pointers for matrix (4 times vec4)
-	glEnableVertexAttribArray(3);
-	glEnableVertexAttribArray(4);
-	glEnableVertexAttribArray(5);
-	glEnableVertexAttribArray(6);
-
-	glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)0);
-	glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(1 * sizeof(glm::vec4)));
-	glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(2 * sizeof(glm::vec4)));
-	glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(3 * sizeof(glm::vec4)));
-
-	glVertexAttribDivisor(3, 1);
-	glVertexAttribDivisor(4, 1);
-	glVertexAttribDivisor(5, 1);
-	glVertexAttribDivisor(6, 1);
-
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	// debug information 
-
-	glGenBuffers(1, &sphDebugBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, sphDebugBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sphParticleDebugs.size() * sizeof(SPHParticleDebug), sphParticleDebugs.data(), GL_DYNAMIC_DRAW);
-
-	glEnableVertexAttribArray(7);
-	glEnableVertexAttribArray(8);
-	glEnableVertexAttribArray(9);
-	glVertexAttribPointer(7, 1, GL_INT, GL_FALSE, sizeof(SPHParticleDebug), (void*)0);
-	glVertexAttribPointer(8, 1, GL_INT, GL_FALSE, sizeof(SPHParticleDebug), (void*)(sizeof(int)));
-	glVertexAttribPointer(9, 1, GL_FLOAT, GL_FALSE, sizeof(SPHParticleDebug), (void*)(sizeof(int) * 2));
-	glVertexAttribDivisor(7, 1);
-	glVertexAttribDivisor(8, 1);
-	glVertexAttribDivisor(9, 1);
-
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	glBindVertexArray(0);
-
-	glBindVertexArray(0);
-
+	// the gl buffers grow on the next uploadFrame
 	std::cout << parts.size() << std::endl;
 
 	for (int i = 0; i < parts.size(); i++)
 	{
-		Cell* cell = grid.getCellFromPosition(parts[i]->getPosition());
-		if (cell != nullptr)
-			cell->addSphParticle(parts[i]);
+		grid.addSphParticle(sphParticles, parts[i]);
 	}
 
 }
@@ -499,24 +1127,16 @@ void ParticleGenerator::debugNeighbours(float deltaTime, float time)
 		sphParticleDebugs[i].isNearestNeighbourTarget = false;
 	}
 
-	Cell* cell = grid.getCellFromPosition(sphParticles[particleID]->getPosition());
-	std::vector<SphParticle*> parts = grid.getNeighbouringSPHPaticlesInRadius(sphParticles[particleID]);
-	// std::cout << parts.size() << "neighbours" << std::endl;
-
+	// the list the solver uses. the grid's cell list is left stale while the verlet lists are valid
 	sphParticleDebugs[particleID].isNearestNeighbourTarget = true;
-	for (int i = 0; i < parts.size(); i++)
+	if ((uint32_t)particleID < sphNeighbours.particleCount())
 	{
-		sphParticleDebugs[parts[i]->getId()].isNearestNeighbour = true;
+		for (uint32_t j : sphNeighbours[particleID])
+			sphParticleDebugs[j].isNearestNeighbour = true;
 	}
 	if (timePast > (float)60 / sphParticles.size()) {
 		timePast = 0;
 		iter++;
 	}
 	timePast += deltaTime;
-
-	glBindBuffer(GL_ARRAY_BUFFER, sphDebugBuffer);
-	void* debugData = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-	memcpy(debugData, sphParticleDebugs.data(), sizeof(sphParticleDebugs[0]) * sphParticleDebugs.size());
-	glUnmapBuffer(GL_ARRAY_BUFFER);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
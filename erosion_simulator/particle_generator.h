@@ -1,12 +1,16 @@
 #pragma once
 #include "sph.h"
-#include "sph_particle.h"
+#include "particle_store.h"
 #include "terrain_particle.h"
 #include "mesh/mesh.h"
 #include "shader/shader.h"
 #include <vector>
 #include "grid_3d.h"
+#include "neighbour_list.h"
+#include "simulation_stats.h"
+#include "thread_pool.h"
 #include "mesh/terrain_mesh.h"
+#include "heightfield_boundary.h"
 
 struct SPHParticleDebug {
 	int isNearestNeighbourTarget;
@@ -22,6 +26,30 @@ struct SPHParticleDebug {
 	}
 };
 
+// sediment a fluid particle took from a terrain particle
+struct TerrainErosion {
+	uint32_t terrainParticle;
+	float amount;
+};
+
+// erosion gathered by one thread, binned by the tile it lands in so each tile can be applied by one thread without
+// touching the others. height changes by heightfield tile (which also keeps the tile versions to one thread),
+// terrain particles by range of particles
+struct ErosionBuffer {
+	std::vector<std::vector<HeightDelta>> heightDeltas;
+	std::vector<std::vector<TerrainErosion>> terrainParticles;
+
+	void clear(uint32_t heightTileCount, uint32_t particleTileCount)
+	{
+		heightDeltas.resize(heightTileCount);
+		terrainParticles.resize(particleTileCount);
+		for (std::vector<HeightDelta>& deltas : heightDeltas)
+			deltas.clear();
+		for (std::vector<TerrainErosion>& erosions : terrainParticles)
+			erosions.clear();
+	}
+};
+
 struct BoundaryParticleDebug {
 	int isNearestNeighbour;
 	BoundaryParticleDebug() {
@@ -29,19 +57,59 @@ struct BoundaryParticleDebug {
 	}
 };
 
+// Everything the renderer needs from one simulation step, copied out so the simulation can go on with the next
+// step while the render thread uploads it.
+struct SimulationFrame {
+	std::vector<glm::mat4> particleModels;
+	std::vector<SPHParticleDebug> sphParticleDebugs;
+	std::vector<glm::mat4> terrainParticleModels;
+	std::vector<BoundaryParticleDebug> boundaryParticleDebugs;
+	// the eroded terrain, without the original heights
+	Heightfield terrainHeights;
+	// occupied cells for the grid debug view, only filled in hashed mode
+	std::vector<uint64_t> gridCells;
+	SimulationStats stats;
+};
+
 // Represents the system responsible for all particles of the erosion model.
+// step, addParticles and debugNeighbours only touch the simulation state (and the terrain mesh vertices),
+// the draw and upload functions only the gl state, so the two halves can run on different threads.
 class ParticleGenerator
 {
 public:
-	ParticleGenerator(Shader& shader, Mesh* sphMesh, Mesh* boundaryMesh, HeightMap* map, TerrainMesh* terrain, float terrainSpacing, float cellSize, float particleRadius, int numPerSquare, SPHSettings* settings);
+	ParticleGenerator(Shader& shader, Mesh* sphMesh, Mesh* boundaryMesh, HeightMap* map, TerrainMesh* terrain, float terrainSpacing, float cellSize, float particleRadius, int numPerSquare, SPHSettings* settings, GridMode gridMode,
+		BoundaryModel boundaryModel = BoundaryModel::TERRAIN_PARTICLES);
 	void drawParticles();
 	void drawTerrainParticles();
 	void drawGridDebug();
+	// step, publish and upload in one go, for running without a simulation thread
 	void updateParticles(float deltaTime, float time);
+	void step(float deltaTime, float time);
+	void publishFrame(SimulationFrame& frame) const;
+	void uploadFrame(const SimulationFrame& frame);
 	void addParticles(glm::vec3 pos, float radius, float intensity);
 	void debugNeighbours(float deltaTime, float time);
+	const SimulationStats& getStats() const { return stats; }
+	// largest step the cfl and force conditions allow after the last step, at most maxTimeStep
+	float getStableTimeStep(float maxTimeStep) const;
 
 private:
+	void buildNeighbourLists();
+	void updateSleeping();
+	void calculateDensity(uint32_t i, int thread);
+	glm::vec3 getBoundaryGradient(uint32_t i) const;
+	glm::vec3 calculateBoundaryPressureForce(uint32_t i) const;
+	bool sleepingEnabled() const;
+	bool verletListsValid() const;
+	void reorderParticles();
+	void solvePcisph();
+	void solveDfsph();
+	void solvePbf();
+	template <typename Stiffness>
+	int runDfsphSolver(AlignedVector<float>& storedStiffness, float tolerance, Stiffness stiffnessOf, float& error);
+	void applyDfsphCorrection();
+	template <typename Append>
+	void buildNeighbourList(NeighbourList& list, Append append);
 
 	HeightMap* _heightmap;
 	TerrainMesh* terrain;
@@ -54,9 +122,66 @@ private:
 	uint32_t terrainParticlesBuffer = 0;
 	uint32_t terrainParticlesDebugBuffer = 0;
 
-	std::vector<SphParticle*> sphParticles;
+	ParticleStore sphParticles;
 	std::vector<TerrainParticle*> terrainParticles;
 
+	// rebuilt every step, indexed like sphParticles
+	NeighbourList sphNeighbours;
+	NeighbourList boundaryNeighbours;
+
+	// in heightfield mode there are no terrain particles, the boundary is sampled at the predicted position of every
+	// particle with its density
+	BoundaryModel boundaryModel;
+	HeightfieldBoundary boundary;
+	std::vector<BoundarySample> boundarySamples;
+
+	// pairs j > i of sphNeighbours, only built when the half list mode is on
+	NeighbourList sphHalfNeighbours;
+	bool sphHalfNeighboursValid = false;
+	std::vector<glm::vec3> velocityChanges;
+	std::vector<float> sedimentChanges;
+	std::vector<glm::vec3> nonPressureVelocityChanges;
+	std::vector<float> densityErrors;
+	std::vector<float> dfsphFactors;
+	std::vector<float> dfsphStiffness;
+	std::vector<glm::vec3> velocityCorrections;
+	std::vector<glm::vec3> positionCorrections;
+	// particles frozen for this step, the densities before this step's sweep, and the terrain particles
+	// (terrain vertices in heightfield mode) eroded by the last step, they wake the particles next to them
+	std::vector<uint8_t> asleep;
+	std::vector<float> previousDensities;
+	std::vector<uint8_t> terrainChanged;
+
+	// per thread buffers, merged in thread order (which is particle order) after each parallel phase
+	ThreadPool pool;
+	std::vector<NeighbourList> threadNeighbours;
+	std::vector<std::vector<glm::vec3>> threadVelocityChanges;
+	// the particle threadVelocityChanges[thread][0] belongs to
+	std::vector<uint32_t> threadVelocityChangesBegin;
+	std::vector<ErosionBuffer> threadErosion;
+	std::vector<std::vector<CellMigration>> threadMigrations;
+	// particles integrated before each batch of terrain collisions
+	static const uint32_t collisionBlockSize = 256;
+	std::vector<std::vector<CellMigration>> terrainMigrations;
+	// largest squared velocity change and speed seen by each thread
+	std::vector<float> threadMaxVelocityChange2;
+	std::vector<float> threadMaxSpeed2;
+	// simd checks of the step, summed into the stats
+	std::vector<SimdValidationCounts> threadSimdValidations;
+
+	// positions at the last verlet build, and the search radius used for it
+	std::vector<glm::vec3> verletPositions;
+	float verletRadius = 0;
+
+	SimulationStats stats;
+	// published and uploaded by updateParticles
+	SimulationFrame localFrame;
+
+	// what the gl buffers hold, only touched by uploadFrame and the draw functions
+	size_t drawnParticleCount = 0;
+	size_t drawnTerrainParticleCount = 0;
+	std::vector<uint64_t> drawnGridCells;
+
 	std::vector<glm::mat4> particleModels;
 	std::vector<glm::mat4> particleModelsTerrain;
 	std::vector<SPHParticleDebug> sphParticleDebugs;
@@ -0,0 +1,132 @@
+#include "particle_store.h"
+#include "sph_kernels.h"
+#include <cmath>
+#include <algorithm>
+
+ParticleStore::ParticleStore()
+	:ParticleStore(0.05f)
+{
+}
+
+ParticleStore::ParticleStore(float radius)
+	:radius(radius)
+{
+	volume = 4.0f / 3.0f * pi * powf(radius, 3);
+}
+
+uint32_t ParticleStore::add(glm::vec3 position)
+{
+	uint32_t i = (uint32_t)size();
+	px.push_back(position.x);
+	py.push_back(position.y);
+	pz.push_back(position.z);
+	vx.push_back(0);
+	vy.push_back(0);
+	vz.push_back(0);
+	density.push_back(1);
+	sedimentDensity.push_back(0);
+	sediment.push_back(0);
+	mass.push_back(1);
+	densityStiffness.push_back(0);
+	divergenceStiffness.push_back(0);
+	stillSteps.push_back(0);
+	return i;
+}
+
+void ParticleStore::reserve(size_t count)
+{
+	px.reserve(count);
+	py.reserve(count);
+	pz.reserve(count);
+	vx.reserve(count);
+	vy.reserve(count);
+	vz.reserve(count);
+	density.reserve(count);
+	sedimentDensity.reserve(count);
+	sediment.reserve(count);
+	mass.reserve(count);
+	densityStiffness.reserve(count);
+	divergenceStiffness.reserve(count);
+	stillSteps.reserve(count);
+}
+
+void ParticleStore::predictPositions(float timeStep)
+{
+	qx.resize(size());
+	qy.resize(size());
+	qz.resize(size());
+	for (size_t i = 0; i < size(); i++)
+	{
+		qx[i] = px[i] + vx[i] * timeStep;
+		qy[i] = py[i] + vy[i] * timeStep;
+		qz[i] = pz[i] + vz[i] * timeStep;
+	}
+}
+
+template <typename T>
+static void gather(AlignedVector<T>& values, const std::vector<uint32_t>& order, AlignedVector<T>& scratch)
+{
+	scratch.resize(values.size());
+	for (size_t i = 0; i < order.size(); i++)
+		scratch[i] = values[order[i]];
+	values.swap(scratch);
+}
+
+void ParticleStore::reorder(const std::vector<uint32_t>& order)
+{
+	AlignedVector<float> scratch;
+	gather(px, order, scratch);
+	gather(py, order, scratch);
+	gather(pz, order, scratch);
+	gather(vx, order, scratch);
+	gather(vy, order, scratch);
+	gather(vz, order, scratch);
+	gather(density, order, scratch);
+	gather(sedimentDensity, order, scratch);
+	gather(sediment, order, scratch);
+	gather(mass, order, scratch);
+	gather(densityStiffness, order, scratch);
+	gather(divergenceStiffness, order, scratch);
+	AlignedVector<int> intScratch;
+	gather(stillSteps, order, intScratch);
+}
+
+void ParticleStore::clampSedimentConserved()
+{
+	// sediment cut by the clamp, minus sediment added by it
+	float excess = 0;
+	float room = 0, carried = 0;
+	for (size_t i = 0; i < sediment.size(); i++)
+	{
+		float clamped = std::clamp(sediment[i], 0.0f, sedimentSaturation);
+		excess += sediment[i] - clamped;
+		sediment[i] = clamped;
+		room += sedimentSaturation - clamped;
+		carried += clamped;
+	}
+
+	if (excess > 0 && room > 0)
+	{
+		float share = std::min(1.0f, excess / room);
+		for (size_t i = 0; i < sediment.size(); i++)
+			sediment[i] += (sedimentSaturation - sediment[i]) * share;
+	}
+	else if (excess < 0 && carried > 0)
+	{
+		float share = std::min(1.0f, -excess / carried);
+		for (size_t i = 0; i < sediment.size(); i++)
+			sediment[i] -= sediment[i] * share;
+	}
+}
+
+float ParticleStore::takeSediment(uint32_t i, float amount)
+{
+	if (sediment[i] + amount > sedimentSaturation) {
+		amount = sedimentSaturation - sediment[i];
+	}
+	else if (sediment[i] + amount < 0)
+		amount = 0 - sediment[i];
+
+	sediment[i] += amount;
+	return amount;
+}
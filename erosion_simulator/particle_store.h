@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "glm/glm.hpp"
+#include "aligned_allocator.h"
+
+// Fluid particles stored as structure of arrays, particle i is the i-th entry of every array.
+// Replaces the separately allocated SphParticle objects, so the sph loops walk contiguous memory.
+class ParticleStore
+{
+public:
+	ParticleStore();
+	ParticleStore(float radius);
+
+	uint32_t add(glm::vec3 position);
+	void reserve(size_t count);
+	// moves particle order[i] to index i
+	void reorder(const std::vector<uint32_t>& order);
+	size_t size() const { return px.size(); }
+
+	glm::vec3 getPosition(uint32_t i) const { return glm::vec3(px[i], py[i], pz[i]); }
+	glm::vec3 getVelocity(uint32_t i) const { return glm::vec3(vx[i], vy[i], vz[i]); }
+	void setPosition(uint32_t i, glm::vec3 position) { px[i] = position.x; py[i] = position.y; pz[i] = position.z; }
+	void setVelocity(uint32_t i, glm::vec3 velocity) { vx[i] = velocity.x; vy[i] = velocity.y; vz[i] = velocity.z; }
+	// position + velocity * timeStep, as of the last predictPositions call
+	glm::vec3 getPredictedPosition(uint32_t i) const { return glm::vec3(qx[i], qy[i], qz[i]); }
+	void setPredictedPosition(uint32_t i, glm::vec3 position) { qx[i] = position.x; qy[i] = position.y; qz[i] = position.z; }
+	void predictPositions(float timeStep);
+
+	// clamps to what the particle can carry, returns the amount actually taken (negative when deposited)
+	float takeSediment(uint32_t i, float amount);
+	// Brings every particle back within [0, saturation] without changing the total: what was cut above saturation is
+	// spread over the particles with room left (in proportion to that room), what was added to lift particles back
+	// to 0 is taken from the ones that carry some (in proportion to what they carry). Only what doesn't fit anywhere
+	// is lost. Serial, in particle order.
+	void clampSedimentConserved();
+	float getSedimentVolume(uint32_t i) const { return sediment[i] / volume; }
+	float getMaxSedimentVolume() const { return sedimentSaturation / volume; }
+	float getRadius() const { return radius; }
+
+	AlignedVector<float> px, py, pz;
+	AlignedVector<float> vx, vy, vz;
+	AlignedVector<float> qx, qy, qz; // predicted positions, not kept in order by reorder
+	AlignedVector<float> density;
+	AlignedVector<float> sedimentDensity;
+	AlignedVector<float> sediment;
+	AlignedVector<float> mass;
+	AlignedVector<float> pressure; // pressure solver scratch, only valid during a step, not kept in order by reorder
+	// dfsph stiffness of the last step, for the warm start of the next
+	AlignedVector<float> densityStiffness;
+	AlignedVector<float> divergenceStiffness;
+	// steps in a row the particle has been below the sleep thresholds, it sleeps from SPHSettings::sleepSteps on
+	AlignedVector<int> stillSteps;
+
+	const float sedimentSaturation = 1; // likely not realistic, but better for showcasing erosion
+private:
+	// every particle has the same radius, so the sphere volume is only computed once
+	float radius;
+	float volume;
+};
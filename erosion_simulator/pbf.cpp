@@ -0,0 +1,34 @@
+#include "pbf.h"
+#include "sph_kernels.h"
+#include <glm/gtx/norm.hpp>
+#include <algorithm>
+
+// the constraint only pushes apart, so particles at the free surface (too few neighbours) aren't pulled into clumps
+float calculatePbfLambda(ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, glm::vec3 boundaryGradient, const SPHSettings& settings)
+{
+	float constraint = std::max(0.0f, particles.density[i] / settings.restDensity - 1);
+	glm::vec3 gradientSum = boundaryGradient / settings.restDensity;
+	float gradientDotSum = 0;
+	withDensityKernel(settings, [&](auto kernel) {
+		forEachGradient(kernel, particles, i, neighbours, settings, [&](uint32_t j, glm::vec3 gradient) {
+			glm::vec3 weighted = particles.mass[j] / settings.restDensity * gradient;
+			gradientSum += weighted;
+			gradientDotSum += glm::dot(weighted, weighted);
+		});
+	});
+
+	particles.pressure[i] = -constraint / (glm::dot(gradientSum, gradientSum) + gradientDotSum + settings.pbfRelaxation);
+	return constraint;
+}
+
+glm::vec3 calculatePbfPositionCorrection(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, glm::vec3 boundaryGradient, const SPHSettings& settings)
+{
+	float lambdaI = particles.pressure[i];
+	glm::vec3 correction = lambdaI * boundaryGradient;
+	withDensityKernel(settings, [&](auto kernel) {
+		forEachGradient(kernel, particles, i, neighbours, settings, [&](uint32_t j, glm::vec3 gradient) {
+			correction += particles.mass[j] * (lambdaI + particles.pressure[j]) * gradient;
+		});
+	});
+	return correction / settings.restDensity;
+}
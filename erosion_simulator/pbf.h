@@ -0,0 +1,20 @@
+#pragma once
+#include "sph.h"
+
+// Position based fluids (Macklin and Mueller 2013).
+// https://doi.org/10.1145/2461912.2461984
+// A preview mode: the positions are predicted from the velocity, gravity and the non pressure forces, then moved a
+// fixed number of times (pbfIterations) towards the rest density, and the velocity is taken from how far they
+// moved. It doesn't conserve much, but it can't blow up whatever the time step. One iteration, over every particle:
+//   1. calculateDensities at the predicted positions, then calculatePbfLambda into ParticleStore::pressure
+//   2. calculatePbfPositionCorrection from the lambdas, applied once every particle has its correction
+// Like pcisph, the neighbour lists of the step are reused and the distances must not be cached.
+// boundaryGradient is the boundary's term of sum_j m_j grad W_ij (see HeightfieldBoundary), zero without one. The
+// boundary doesn't move and only takes the lambda of i.
+
+// lambda_i = -C_i / (sum_k |grad_k C_i|^2 + pbfRelaxation), C_i = rho_i / rho_0 - 1 kept at or above 0.
+// returns C_i, the relative density error
+float calculatePbfLambda(ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, glm::vec3 boundaryGradient, const SPHSettings& settings);
+
+// 1 / rho_0 sum_j m_j (lambda_i + lambda_j) grad W_ij
+glm::vec3 calculatePbfPositionCorrection(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, glm::vec3 boundaryGradient, const SPHSettings& settings);
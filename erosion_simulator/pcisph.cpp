@@ -0,0 +1,68 @@
+#include "pcisph.h"
+#include "sph_kernels.h"
+#include <glm/gtx/norm.hpp>
+#include <algorithm>
+
+// the neighbourhood is a lattice at the rest spacing (the spacing where mass / volume is the rest density)
+float calculatePcisphDelta(const SPHSettings& settings)
+{
+	float spacing = cbrtf(settings.mass / settings.restDensity);
+	int extent = (int)ceilf(settings.h / spacing);
+	glm::vec3 gradientSum(0);
+	float gradientDotSum = 0;
+	withDensityKernel(settings, [&](auto kernel) {
+		for (int x = -extent; x <= extent; x++)
+			for (int y = -extent; y <= extent; y++)
+				for (int z = -extent; z <= extent; z++)
+				{
+					glm::vec3 r = glm::vec3(x, y, z) * spacing;
+					float dist = glm::length(r);
+					if (dist == 0 || dist > settings.h) continue;
+					glm::vec3 gradient = r / dist * kernel.derivative(settings, dist);
+					gradientSum += gradient;
+					gradientDotSum += glm::dot(gradient, gradient);
+				}
+	});
+
+	float beta = 2 * powf(settings.timeStep * settings.mass / settings.restDensity, 2);
+	float denominator = beta * (glm::dot(gradientSum, gradientSum) + gradientDotSum);
+	return denominator > 0 ? 1 / denominator : 0;
+}
+
+// the pressure isn't allowed to go negative, so particles at the free surface (too few neighbours) aren't pulled in
+float correctPcisphPressure(ParticleStore& particles, uint32_t i, float delta, const SPHSettings& settings)
+{
+	float densityError = particles.density[i] - settings.restDensity;
+	particles.pressure[i] = std::max(0.0f, particles.pressure[i] + delta * densityError);
+	return std::max(0.0f, densityError) / settings.restDensity;
+}
+
+template <typename Kernel>
+static glm::vec3 calculatePcisphPressureForces(Kernel, const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, glm::vec3 boundaryGradient, const SPHSettings& settings)
+{
+	glm::vec3 predicted = particles.getPredictedPosition(i);
+	float pressureTermI = particles.pressure[i] / (particles.density[i] * particles.density[i]);
+	glm::vec3 acceleration(0);
+	for (uint32_t n = 0; n < neighbours.size(); n++)
+	{
+		uint32_t j = neighbours[n];
+		glm::vec3 ab = particles.getPredictedPosition(j) - predicted;
+		float dist2 = glm::length2(ab);
+		if (dist2 > settings.h2) continue;
+		float dist = std::max(0.001f, sqrtf(dist2));
+
+		// gradient of W with respect to i, it points towards j since W falls off with distance
+		glm::vec3 gradient = -ab / dist * Kernel::derivative(settings, dist);
+		float pressureTermJ = particles.pressure[j] / (particles.density[j] * particles.density[j]);
+		acceleration -= particles.mass[j] * (pressureTermI + pressureTermJ) * gradient;
+	}
+	acceleration -= pressureTermI * boundaryGradient;
+	return acceleration * settings.timeStep;
+}
+
+glm::vec3 calculatePcisphPressureForces(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, glm::vec3 boundaryGradient, const SPHSettings& settings)
+{
+	glm::vec3 velocityChange;
+	withDensityKernel(settings, [&](auto kernel) { velocityChange = calculatePcisphPressureForces(kernel, particles, i, neighbours, boundaryGradient, settings); });
+	return velocityChange;
+}
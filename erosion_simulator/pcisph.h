@@ -0,0 +1,23 @@
+#pragma once
+#include "sph.h"
+
+// Predictive-corrective incompressible SPH (Solenthaler and Pajarola 2009).
+// https://doi.org/10.1145/1576246.1531346
+// Instead of taking the pressure from the density with a stiff multiplier, the pressure is corrected over a few
+// iterations until the density at the positions it predicts is close to the rest density, which keeps the fluid
+// stable at much larger time steps. One iteration, run by the caller over every particle:
+//   1. predictPosition from the velocity plus the non pressure and pressure velocity changes so far
+//   2. calculateDensities at the predicted positions, then correctPcisphPressure
+//   3. calculatePcisphPressureForces from the corrected pressures
+// The neighbour lists of the step are reused, the distances must not be cached since the positions move.
+// boundaryGradient is the boundary's term of sum_j m_j grad W_ij (see HeightfieldBoundary), zero without one.
+// The boundary doesn't move, it pushes back with the pressure of i.
+
+// pressure change per unit of density error for the current timeStep, from a particle with a filled neighbourhood
+float calculatePcisphDelta(const SPHSettings& settings);
+
+// adds delta times the density error to the pressure (kept at or above 0), returns the relative density error
+float correctPcisphPressure(ParticleStore& particles, uint32_t i, float delta, const SPHSettings& settings);
+
+// velocity change of i from the pressures, at the predicted positions and densities
+glm::vec3 calculatePcisphPressureForces(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, glm::vec3 boundaryGradient, const SPHSettings& settings);
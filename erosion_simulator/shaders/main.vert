@@ -1,8 +1,8 @@
 #version 330 core
-layout (location = 0) in vec3 pos;
+// the terrain is a gridWidth x gridLength grid, x and z of a vertex come from its index
+layout (location = 0) in float height;
 layout (location = 1) in vec3 normal;
-layout (location = 2) in vec2 uv;
-layout (location = 3) in float originalHeight;
+layout (location = 2) in float originalHeight;
 
 out vec3 fragPos;
 out vec3 fragNormal;
@@ -12,12 +12,17 @@ out float fragOriginalHeight;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform int gridWidth;
+uniform int gridLength;
 
 void main()
 {
+	int x = gl_VertexID % gridWidth;
+	int z = gl_VertexID / gridWidth;
+	vec3 pos = vec3(x - gridWidth / 2, height, z - gridLength / 2);
 	fragPos = pos;
 	fragNormal = normal;
-	texCoord = uv;
+	texCoord = vec2(float(x) / gridWidth, float(z) / gridLength) * (gridWidth / 10.0);
 	fragOriginalHeight = originalHeight;
 	gl_Position = projection * view * model * vec4(pos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+// Counters filled in by the simulation every step, read by the UI.
+struct SimulationStats
+{
+	int steps = 0;
+
+	// verlet neighbour lists
+	int neighbourRebuilds = 0;
+	int stepsSinceNeighbourRebuild = 0;
+
+	int particleReorders = 0;
+
+	// simd results compared against scalar, and how many were off by more than the tolerance
+	unsigned int simdValidations = 0;
+	unsigned int simdMismatches = 0;
+
+	// wall time of the steps of the last frame and how many there were, filled in by the simulation thread
+	float stepMilliseconds = 0;
+	int substeps = 0;
+
+	// step size of the last step, and the largest speed and acceleration it produced (used by the adaptive step)
+	float timeStep = 0;
+	float maxSpeed = 0;
+	float maxAcceleration = 0;
+
+	// iterations of the pressure solver in the last step and the average density error it stopped at
+	int pressureIterations = 0;
+	float densityError = 0;
+	// same for the dfsph divergence solver
+	int divergenceIterations = 0;
+	float divergenceError = 0;
+
+	// particles simulated and frozen in the last step, see SPHSettings::particleSleeping
+	unsigned int activeParticles = 0;
+	unsigned int sleepingParticles = 0;
+};
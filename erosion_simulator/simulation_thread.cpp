@@ -0,0 +1,151 @@
+#include "simulation_thread.h"
+#include <chrono>
+#include <algorithm>
+
+SimulationThread::SimulationThread(ParticleGenerator* particles, SPHSettings* settings)
+	:particles(particles), settings(settings), pendingSettings(*settings)
+{
+	// the render thread draws whatever it has until the first step is published
+	particles->publishFrame(frames[front]);
+}
+
+SimulationThread::~SimulationThread()
+{
+	stop();
+}
+
+void SimulationThread::start()
+{
+	if (thread.joinable()) return;
+	stopping = false;
+	thread = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	if (thread.joinable())
+		thread.join();
+}
+
+void SimulationThread::setSettings(const SPHSettings& newSettings)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	pendingSettings = newSettings;
+}
+
+void SimulationThread::setRunning(bool newRunning)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = newRunning;
+	}
+	wake.notify_all();
+}
+
+void SimulationThread::setDebugNeighbours(bool newDebugNeighbours)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	debugNeighbours = newDebugNeighbours;
+}
+
+void SimulationThread::addParticles(glm::vec3 pos, float radius, float intensity)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	pendingAdditions.push_back({ pos, radius, intensity });
+}
+
+bool SimulationThread::acquireFrame()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!frameReady) return false;
+	std::swap(front, ready);
+	frameReady = false;
+	return true;
+}
+
+void SimulationThread::run()
+{
+	std::vector<ParticleAddition> additions;
+	float time = 0;
+	// simulated time still owed to the wall clock
+	float accumulator = 0;
+	auto previous = std::chrono::steady_clock::now();
+	while (true)
+	{
+		bool stepRunning, stepDebugNeighbours;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			// additions still go in while paused, so painting shows up straight away
+			wake.wait(lock, [&] { return stopping || running || !pendingAdditions.empty(); });
+			if (stopping) return;
+
+			// the kernel constants are computed by the generator, keep them rather than the ui's
+			SPHKernelConstants kernels = settings->kernels;
+			*settings = pendingSettings;
+			settings->kernels = kernels;
+			additions.swap(pendingAdditions);
+			stepRunning = running;
+			stepDebugNeighbours = debugNeighbours;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		// more than a quarter of a second (a pause, the window being dragged) isn't caught up on
+		if (stepRunning)
+			accumulator += std::min(0.25f, std::chrono::duration<float>(start - previous).count());
+		else
+			accumulator = 0;
+		previous = start;
+
+		bool added = !additions.empty();
+		for (const ParticleAddition& addition : additions)
+			particles->addParticles(addition.pos, addition.radius, addition.intensity);
+		additions.clear();
+
+		// timeStep from the ui is the fixed step, or the largest one in adaptive mode
+		float maxTimeStep = settings->timeStep;
+		float timeStep = maxTimeStep;
+		int substeps = 0;
+		if (stepRunning)
+		{
+			while (true)
+			{
+				timeStep = settings->adaptiveTimeStep ? particles->getStableTimeStep(maxTimeStep) : maxTimeStep;
+				if (accumulator < timeStep || substeps == settings->maxSubsteps) break;
+
+				settings->timeStep = timeStep;
+				particles->step(timeStep, time);
+				time += timeStep;
+				accumulator -= timeStep;
+				substeps++;
+			}
+			// the steps take longer than the time they simulate, drop the rest rather than fall further behind
+			if (substeps == settings->maxSubsteps)
+				accumulator = 0;
+			if (substeps > 0 && stepDebugNeighbours)
+				particles->debugNeighbours(timeStep, time);
+		}
+
+		if (substeps == 0 && !added)
+		{
+			// nothing new to show, sleep until the next step is due
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait_for(lock, std::chrono::duration<float>(timeStep - accumulator), [&] { return stopping; });
+			continue;
+		}
+
+		particles->publishFrame(frames[back]);
+		auto end = std::chrono::steady_clock::now();
+		frames[back].stats.stepMilliseconds = std::chrono::duration<float, std::milli>(end - start).count();
+		frames[back].stats.substeps = substeps;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::swap(back, ready);
+			frameReady = true;
+		}
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include "particle_generator.h"
+#include "sph.h"
+
+// Runs ParticleGenerator::step on its own thread, so the render loop isn't held up by the simulation.
+// Steps are taken from an accumulator of wall time (see SPHSettings::adaptiveTimeStep), each frame is
+// the substeps taken since the last one.
+// Each frame is published through a triple buffer: the simulation fills back, swaps it with ready,
+// and the render thread swaps ready with front when it wants a new frame. Neither side ever waits on the other
+// for more than a swap.
+// The render thread only talks to the simulation through this class, the settings it hands over are copied
+// in at the start of the next step.
+class SimulationThread
+{
+public:
+	// settings is the copy the generator was created with, owned by the caller and only touched by the simulation thread
+	SimulationThread(ParticleGenerator* particles, SPHSettings* settings);
+	~SimulationThread();
+	SimulationThread(const SimulationThread&) = delete;
+	SimulationThread& operator=(const SimulationThread&) = delete;
+
+	void start();
+	void stop();
+
+	// render thread side
+	void setSettings(const SPHSettings& settings);
+	void setRunning(bool running);
+	void setDebugNeighbours(bool debugNeighbours);
+	// queued, the particles are added before the next step
+	void addParticles(glm::vec3 pos, float radius, float intensity);
+	// swaps in the newest frame, false when nothing was published since the last call
+	bool acquireFrame();
+	const SimulationFrame& getFrame() const { return frames[front]; }
+
+private:
+	struct ParticleAddition
+	{
+		glm::vec3 pos;
+		float radius;
+		float intensity;
+	};
+
+	void run();
+
+	ParticleGenerator* particles;
+	SPHSettings* settings;
+	std::thread thread;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	SPHSettings pendingSettings;
+	std::vector<ParticleAddition> pendingAdditions;
+	bool running = false;
+	bool debugNeighbours = false;
+	bool stopping = false;
+
+	// indices into frames, back belongs to the simulation, front to the render thread
+	SimulationFrame frames[3];
+	int back = 0, ready = 1, front = 2;
+	bool frameReady = false;
+};
@@ -2,8 +2,9 @@
 #include <numeric>
 #include <glm/gtx/norm.hpp>
 #include <sph.h>
+#include "sph_kernels.h"
+#include "sph_simd.h"
 #include <iostream>
-#define PI 3.14159265359f
 
 
 SPHSettings::SPHSettings(
@@ -19,91 +20,93 @@ SPHSettings::SPHSettings(
 	, sedimentSaturation(sedimentSaturation)
 	, timeStep(timeStep)
 {
-	h2 = h * h;
-}
-
-// 3.5 
-// Smoothing kernel
-// https://matthias-research.github.io/pages/publications/sca03.pdf
-
-// what good about this kernel is that h is already to the power of two, and so is x
-// sqrt is an expensive computation
-float kernelFuncSmooth(float h2, float x2)
-{
-	if (x2 > h2) return 0;
-
-	float integral = (64 * PI * powf(sqrt(h2), 9)) / 315.0f;
-	float fx = powf(h2 - x2, 3);
-	return fx / integral;
+	updateKernelConstants();
 }
 
-// this kernel is specific to pressure, because the smooth kernels have a vanishing gradient at the center
-// this allows for partciles to be repulsed by eachother.
-// https://matthias-research.github.io/pages/publications/sca03.pdf
-float kernelFuncSpiky3(float h, float x)
+void SPHSettings::updateKernelConstants()
 {
-	if (x > h) return 0;
-
-	float integral = (PI * powf(h, 6)) / 15.0f;
-	float fx = powf(h - x, 3);
-	return fx / integral;
-}
-
-// https://github.com/SebLague/Fluid-Sim
-float kernelFuncSpiky2(float h, float x)
-{
-	if (x > h) return 0;
-
-	float integral = (2 * PI * pow(h, 5)) / 15.0f;
-	float fx = powf(h - x, 2);
-	return fx / integral;
-
+	h2 = h * h;
+	kernels.h = h;
+	kernels.h3 = h2 * h;
+	kernels.poly6 = Poly6Kernel::normalisation(h);
+	kernels.spiky = SpikyKernel::normalisation(h);
+	kernels.spiky2 = Spiky2Kernel::normalisation(h);
+	kernels.viscosity = ViscosityKernel::normalisation(h);
+	kernels.wendlandC2 = WendlandC2Kernel::normalisation(h);
+	kernels.cubicSpline = CubicSplineKernel::normalisation(h);
 }
 
-// https://matthias-research.github.io/pages/publications/sca03.pdf
-float kernelFuncViscosity(float h, float dist)
+// the distance is only taken for pairs within h, the others are never read
+void cachePairDistances(const ParticleStore& particles, NeighbourList& neighbours, uint32_t begin, uint32_t end, const SPHSettings& settings)
 {
-	if (dist > h) return 0;
-	float integral = (2 * PI * powf(h, 3)) / 15.0f;
-	float fx = -(powf(dist, 3) / (2 * powf(h, 3))) + (powf(dist, 2) / (powf(h, 2))) + (h / (2 * dist)) - 1;
-	return fx / integral;
+	for (uint32_t i = begin; i < end; i++)
+	{
+		glm::vec3 predicted = particles.getPredictedPosition(i);
+		for (uint32_t n = neighbours.offsets[i]; n < neighbours.offsets[i + 1]; n++)
+		{
+			float dist2 = glm::length2(particles.getPredictedPosition(neighbours.indices[n]) - predicted);
+			neighbours.distances2[n] = dist2;
+			neighbours.distances[n] = dist2 > settings.h2 ? 0 : sqrt(dist2);
+		}
+	}
 }
 
-
-void calculateDensity(SphParticle* particle, std::vector<SphParticle*> neighbours,
-	const SPHSettings& settings)
+// density and sediment density share the neighbour sweep, the sediment density is the density weighted by
+// how full each particle is
+template <typename Kernel>
+static void calculateDensities(Kernel, const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours,
+	const SPHSettings& settings, float& density, float& sedimentDensity)
 {
-	float density = 0;
-	for (int i = 0; i < neighbours.size(); i++) {
-
-		float dist2 = glm::length2((neighbours[i]->getPosition() + neighbours[i]->getVelocity() * settings.timeStep) - (particle->getPosition() + particle->getVelocity() * settings.timeStep));
-		if (dist2 > settings.h2) continue;
-		float dist = sqrt(dist2);
-		density += neighbours[i]->mass * kernelFuncSpiky3(settings.h, dist);
+	glm::vec3 predicted = particles.getPredictedPosition(i);
+	density = 0;
+	sedimentDensity = 0;
+	for (uint32_t n = 0; n < neighbours.size(); n++) {
+		uint32_t j = neighbours[n];
+		float dist2, dist;
+		if (neighbours.distances2)
+		{
+			dist2 = neighbours.distances2[n];
+			if (dist2 > settings.h2) continue;
+			dist = neighbours.distances[n];
+		}
+		else
+		{
+			dist2 = glm::length2(particles.getPredictedPosition(j) - predicted);
+			if (dist2 > settings.h2) continue;
+			dist = sqrt(dist2);
+		}
+		float w = particles.mass[j] * Kernel::value(settings, dist, dist2);
+		density += w;
+		sedimentDensity += w * particles.getSedimentVolume(j) / particles.getMaxSedimentVolume();
 	}
 
 	// add particle self density
-	density += particle->mass * kernelFuncSpiky3(settings.h, 0);
-
-	particle->setDensity(density);
+	float self = particles.mass[i] * Kernel::value(settings, 0, 0);
+	density += self;
+	sedimentDensity += self * particles.getSedimentVolume(i) / particles.getMaxSedimentVolume();
 }
 
-void calculateSedimentDensity(SphParticle* particle, std::vector<SphParticle*> neighbours,
-	const SPHSettings& settings)
+static void calculateDensitiesScalar(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings,
+	float& density, float& sedimentDensity)
 {
-	float density = 0;
-	for (int i = 0; i < neighbours.size(); i++) {
+	withDensityKernel(settings, [&](auto kernel) { calculateDensities(kernel, particles, i, neighbours, settings, density, sedimentDensity); });
+}
 
-		float dist2 = glm::length2((neighbours[i]->getPosition() + neighbours[i]->getVelocity() * settings.timeStep) - (particle->getPosition() + particle->getVelocity() * settings.timeStep));
-		if (dist2 > settings.h2) continue;
-		float dist = sqrt(dist2);
-		density += neighbours[i]->mass * kernelFuncSpiky3(settings.h, dist) * neighbours[i]->getSedimentVolume() / neighbours[i]->getMaxSedimentVolume();
+void calculateDensities(ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings, SimdValidationCounts& validation)
+{
+	float density, sedimentDensity;
+	if (!calculateDensitiesSimd(particles, i, neighbours, settings, density, sedimentDensity))
+		calculateDensitiesScalar(particles, i, neighbours, settings, density, sedimentDensity);
+	else if (settings.validateSimd)
+	{
+		float scalarDensity, scalarSedimentDensity;
+		calculateDensitiesScalar(particles, i, neighbours, settings, scalarDensity, scalarSedimentDensity);
+		validateSimdResult(density, scalarDensity, settings, validation);
+		validateSimdResult(sedimentDensity, scalarSedimentDensity, settings, validation);
 	}
 
-	// add particle self density
-	density += particle->mass * kernelFuncSpiky3(settings.h, 0) * particle->getSedimentVolume() / particle->getMaxSedimentVolume();
-
-	particle->setSedimentDensity(density);
+	particles.density[i] = density;
+	particles.sedimentDensity[i] = sedimentDensity;
 }
 
 float getPressureFromDensity(float density, const SPHSettings& settings)
@@ -111,50 +114,127 @@ float getPressureFromDensity(float density, const SPHSettings& settings)
 	return (density - settings.restDensity) * settings.pressureMultiplier;
 }
 
-void calculatePressureForce(SphParticle* particle, std::vector<SphParticle*> neighbours, const SPHSettings& settings)
+// pressure, surface tension and viscosity in one sweep, all from the velocity of i before this call.
+// without Pressure only the surface tension and viscosity are summed
+template <typename Kernel, bool Pressure = true>
+static glm::vec3 calculateVelocityChange(Kernel, const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings)
 {
 	glm::vec3 pressureForce(0);
+	glm::vec3 surfaceTensionForce(0);
+	glm::vec3 viscosityForce(0);
+	glm::vec3 velocity = particles.getVelocity(i);
+	glm::vec3 predicted = particles.getPredictedPosition(i);
+	float pressureI = getPressureFromDensity(particles.density[i], settings);
 
-	for (int i = 0; i < neighbours.size(); i++)
+	for (uint32_t n = 0; n < neighbours.size(); n++)
 	{
-		glm::vec3 ab = (neighbours[i]->getPosition() + neighbours[i]->getVelocity() * settings.timeStep) - (particle->getPosition() + particle->getVelocity() * settings.timeStep);
-		
-		if (glm::length2(ab) > settings.h2) continue;
-		float dist = glm::length(ab);
-		glm::vec3 dir = ab / std::max(0.001f, dist);
-		float presure = (getPressureFromDensity(particle->getDensity(), settings) + getPressureFromDensity(neighbours[i]->getDensity(), settings)) / 2;
-		pressureForce += -dir * kernelFuncSpiky3(settings.h, dist) * neighbours[i]->mass * presure / neighbours[i]->getDensity();
+		uint32_t j = neighbours[n];
+		float dist2, dist;
+		if (neighbours.distances2)
+		{
+			dist2 = neighbours.distances2[n];
+			if (dist2 > settings.h2) continue;
+			dist = neighbours.distances[n];
+		}
+		else
+		{
+			dist2 = glm::length2(particles.getPredictedPosition(j) - predicted);
+			if (dist2 > settings.h2) continue;
+			dist = sqrt(dist2);
+		}
+		glm::vec3 velocityJ = particles.getVelocity(j);
+		glm::vec3 ab = particles.getPredictedPosition(j) - predicted;
+
+		if (Pressure)
+		{
+			glm::vec3 dir = ab / std::max(0.001f, dist);
+			float presure = (pressureI + getPressureFromDensity(particles.density[j], settings)) / 2;
+			pressureForce += -dir * Kernel::value(settings, dist, dist2) * particles.mass[j] * presure / particles.density[j];
+		}
+
+		// ab points from i to j, the tension pulls i towards j
+		surfaceTensionForce -= ab * Spiky2Kernel::value(settings, dist, dist2) * particles.mass[j];
+
+		// the viscosity kernel goes to infinity at 0, coincident particles (stacked up by the collisions) are left out
+		if (dist2 > 1e-12f)
+			viscosityForce += (velocityJ - velocity) / particles.density[j] * ViscosityKernel::value(settings, dist, dist2) * particles.mass[j];
 	}
-	particle->setVelocity(particle->getVelocity() + pressureForce / particle->getDensity() * settings.timeStep);
+
+	return pressureForce / particles.density[i] * settings.timeStep
+		+ -settings.surfaceTensionMultiplier / particles.mass[i] * surfaceTensionForce * settings.timeStep
+		+ viscosityForce * settings.viscosity * settings.timeStep;
 }
 
-void calculateViscosity(SphParticle* particle, std::vector<SphParticle*> neighbours, const SPHSettings& settings)
+static glm::vec3 calculateVelocityChangeScalar(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings)
 {
-	glm::vec3 viscosityForce(0);
-	for (int i = 0; i < neighbours.size(); i++)
-	{
-		glm::vec3 ab = (neighbours[i]->getPosition() + neighbours[i]->getVelocity() * settings.timeStep) - (particle->getPosition() + particle->getVelocity() * settings.timeStep);
-		if (glm::length2(ab) > settings.h2) continue;
+	glm::vec3 velocityChange;
+	withDensityKernel(settings, [&](auto kernel) { velocityChange = calculateVelocityChange(kernel, particles, i, neighbours, settings); });
+	return velocityChange;
+}
 
-		float dist = glm::length(ab);
-		viscosityForce += (neighbours[i]->getVelocity() - particle->getVelocity()) / neighbours[i]->getDensity() * kernelFuncViscosity(settings.h, dist) * neighbours[i]->mass;
-	}
+glm::vec3 calculateNonPressureForces(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings)
+{
+	// the kernel only matters for the pressure term
+	return calculateVelocityChange<SpikyKernel, false>(SpikyKernel(), particles, i, neighbours, settings);
+}
 
-	particle->setVelocity(particle->getVelocity() + viscosityForce * settings.viscosity * settings.timeStep);
+glm::vec3 calculateForces(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings, SimdValidationCounts& validation)
+{
+	glm::vec3 velocityChange;
+	if (!calculateVelocityChangeSimd(particles, i, neighbours, settings, velocityChange))
+		velocityChange = calculateVelocityChangeScalar(particles, i, neighbours, settings);
+	else if (settings.validateSimd)
+		validateSimdResult(velocityChange, calculateVelocityChangeScalar(particles, i, neighbours, settings), settings, validation);
+	return velocityChange;
 }
 
-void calculateSufaceTension(SphParticle* particle, std::vector<SphParticle*> neighbours, const SPHSettings& settings)
+void predictPosition(ParticleStore& particles, uint32_t i, glm::vec3 velocityChange, const SPHSettings& settings)
 {
-	glm::vec3 surfaceTensionForce(0);
-	for (int i = 0; i < neighbours.size(); i++)
+	glm::vec3 velocity = particles.getVelocity(i) + velocityChange + glm::vec3(0, settings.g, 0) * settings.timeStep;
+	particles.setPredictedPosition(i, particles.getPosition(i) + velocity * settings.timeStep);
+}
+
+template <typename Kernel>
+static void calculatePairForces(Kernel, const ParticleStore& particles, uint32_t i, NeighbourSpan halfNeighbours, glm::vec3* velocityChanges,
+	uint32_t firstIndex, const SPHSettings& settings)
+{
+	glm::vec3 velocity = particles.getVelocity(i);
+	glm::vec3 predicted = particles.getPredictedPosition(i);
+	float pressureI = getPressureFromDensity(particles.density[i], settings);
+	glm::vec3 velocityChange(0);
+	for (uint32_t n = 0; n < halfNeighbours.size(); n++)
 	{
-		glm::vec3 ab = (particle->getPosition() + particle->getVelocity() * settings.timeStep) - (neighbours[i]->getPosition() + neighbours[i]->getVelocity() * settings.timeStep);
-		if (glm::length2(ab) > settings.h2) continue;
+		uint32_t j = halfNeighbours[n];
+		glm::vec3 ab = particles.getPredictedPosition(j) - predicted;
+		float dist2 = glm::length2(ab);
+		if (dist2 > settings.h2) continue;
+		float dist = sqrt(dist2);
 
-		float dist = glm::length(ab);
-		surfaceTensionForce += ab * kernelFuncSpiky2(settings.h, dist) * neighbours[i]->mass;
+		// pressure, ab points from i to j
+		glm::vec3 dir = ab / std::max(0.001f, dist);
+		float presure = (pressureI + getPressureFromDensity(particles.density[j], settings)) / 2;
+		glm::vec3 pressure = dir * Kernel::value(settings, dist, dist2) * presure / (particles.density[i] * particles.density[j]) * settings.timeStep;
+		velocityChange -= pressure * particles.mass[j];
+		velocityChanges[j - firstIndex] += pressure * particles.mass[i];
+
+		// surface tension
+		glm::vec3 tension = ab * Spiky2Kernel::value(settings, dist, dist2) * settings.surfaceTensionMultiplier * settings.timeStep;
+		velocityChange += tension * particles.mass[j] / particles.mass[i];
+		velocityChanges[j - firstIndex] -= tension * particles.mass[i] / particles.mass[j];
+
+		// viscosity, left out for coincident particles like in calculateVelocityChange
+		if (dist2 > 1e-12f)
+		{
+			glm::vec3 viscosity = (particles.getVelocity(j) - velocity) * ViscosityKernel::value(settings, dist, dist2) * settings.viscosity * settings.timeStep;
+			velocityChange += viscosity * particles.mass[j] / particles.density[j];
+			velocityChanges[j - firstIndex] -= viscosity * particles.mass[i] / particles.density[i];
+		}
 	}
-
-	particle->setVelocity(particle->getVelocity() + -settings.surfaceTensionMultiplier / particle->mass * surfaceTensionForce * settings.timeStep);
+	velocityChanges[i - firstIndex] += velocityChange;
 }
 
+void calculatePairForces(const ParticleStore& particles, uint32_t i, NeighbourSpan halfNeighbours, glm::vec3* velocityChanges,
+	uint32_t firstIndex, const SPHSettings& settings)
+{
+	withDensityKernel(settings, [&](auto kernel) { calculatePairForces(kernel, particles, i, halfNeighbours, velocityChanges, firstIndex, settings); });
+}
\ No newline at end of file
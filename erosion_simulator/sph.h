@@ -1,8 +1,54 @@
 #ifndef SPH_SPH_H
 #define SPH_SPH_H
 
-#include "Sph_Particle.h"
+#include "particle_store.h"
+#include "neighbour_list.h"
 
+// kernel used for density and pressure, surface tension and viscosity always use their own kernels
+enum class SPHKernel
+{
+    SPIKY,
+    POLY6,
+    WENDLAND_C2,
+    CUBIC_SPLINE,
+};
+
+// EQUATION_OF_STATE takes the pressure straight from the density (stiff, needs small steps),
+// PCISPH iterates the pressure until the predicted density error is within pressureTolerance, see pcisph.h,
+// DFSPH corrects the velocities for both the density error and the divergence, see dfsph.h,
+// PBF moves the positions a fixed number of times instead, a fast preview that stays stable at any step, see pbf.h
+enum class PressureSolver
+{
+    EQUATION_OF_STATE,
+    PCISPH,
+    DFSPH,
+    PBF,
+};
+
+// instruction set used by the density and force sweeps, see sph_simd.h
+enum class SimdLevel
+{
+    SCALAR,
+    SSE4,
+    AVX2,
+    AVX512,
+};
+
+// simd results compared against the scalar ones (SPHSettings::validateSimd), and how many were off by more than
+// the tolerance. each thread counts into its own
+struct SimdValidationCounts
+{
+    uint32_t checked = 0;
+    uint32_t mismatched = 0;
+};
+
+// normalisation factors of every kernel for the current h, see sph_kernels.h
+struct SPHKernelConstants
+{
+    float h = 0; // h these were computed for
+    float h3;
+    float poly6, spiky, spiky2, viscosity, wendlandC2, cubicSpline;
+};
 
 struct SPHSettings
 {
@@ -13,31 +59,94 @@ struct SPHSettings
     glm::mat4 sphereScale;
     float pressureMultiplier, surfaceTensionMultiplier, mass, h2,
           restDensity, viscosity, h, g, sedimentSaturation, timeStep;
-};
-
-float kernelFuncSmooth(float h2, float x2);
-
-// this kernel is specific to pressure, because the smooth kernels have a vanishing gradient at the center
-// this allows for partciles to be repulsed by eachother.
-// https://matthias-research.github.io/pages/publications/sca03.pdf
-float kernelFuncSpiky3(float h, float x);
-
-
-// https://github.com/SebLague/Fluid-Sim
-float kernelFuncSpiky2(float h, float x);
 
+    SPHKernel densityKernel = SPHKernel::SPIKY;
+
+    PressureSolver pressureSolver = PressureSolver::EQUATION_OF_STATE;
+    // average relative density error the iterative solvers stop at, and their iteration limits
+    float pressureTolerance = 0.01f;
+    int minPressureIterations = 3;
+    int maxPressureIterations = 50;
+    // average relative density change over a step the dfsph divergence solver stops at
+    float divergenceTolerance = 0.01f;
+    // position based fluids, position corrections per step and the constraint force mixing (epsilon in the paper),
+    // which softens the correction of particles with few neighbours
+    int pbfIterations = 3;
+    float pbfRelaxation = 10.0f;
+
+    SPHKernelConstants kernels;
+    // recomputes h2 and the kernel constants, call after changing h
+    void updateKernelConstants();
+
+    // search neighbours within h + verletSkin and only search again once a particle moved more than half the skin
+    bool useVerletLists = false;
+    float verletSkin = 0.05f;
+
+    // steps between sorting the particle store along a morton curve of the grid cells, 0 never sorts
+    int reorderInterval = 100;
+
+    // evaluate every pair once from a half neighbour list (j > i) and apply the force to both particles.
+    // all three forces then see the velocities from before the force phase.
+    bool useHalfNeighbourLists = false;
+
+    // compute the distance of every neighbour pair once per step and share it between the density and force sweeps
+    bool cachePairDistances = false;
+
+    // only spiky and poly6 have simd versions, the other kernels always run scalar.
+    // with validateSimd every simd result is compared against the scalar one, within simdTolerance (relative)
+    SimdLevel simdLevel = SimdLevel::SCALAR;
+    bool validateSimd = false;
+    float simdTolerance = 1e-4f;
+
+    // threads running the parallel parts of the step. the results don't depend on it, apart from the order
+    // the per thread buffers of the half list mode are summed in
+    int threadCount = 1;
+
+    // Particles that stay below sleepSpeed and change their density by less than sleepDensityChange (relative to the
+    // rest density) for sleepSteps steps in a row are frozen: no density, forces, erosion or integration until a
+    // moving neighbour or erosion of the terrain next to them wakes them. Only with the equation of state solver,
+    // the iterative solvers need every particle in the solve.
+    bool particleSleeping = false;
+    float sleepSpeed = 0.05f;
+    float sleepDensityChange = 0.001f;
+    int sleepSteps = 30;
+
+    // The simulation thread runs steps from an accumulator of wall time, so the simulation keeps to real time
+    // whatever the frame rate, with at most maxSubsteps per frame (past that it slows down instead of falling behind).
+    // With adaptiveTimeStep each substep is picked from the cfl (cflNumber * h / max speed) and force
+    // (forceNumber * sqrt(h / max acceleration)) conditions of the last step, and timeStep is the largest it takes.
+    // The simulation thread overwrites timeStep in its copy of the settings with the step it picked.
+    bool adaptiveTimeStep = false;
+    float cflNumber = 0.4f;
+    float forceNumber = 0.25f;
+    float minTimeStep = 0.0001f;
+    int maxSubsteps = 8;
+};
 
-// https://matthias-research.github.io/pages/publications/sca03.pdf
-float kernelFuncViscosity(float h, float dist);
+// the sph functions below read the predicted positions, ParticleStore::predictPositions has to be called first
+// fills neighbours.distances2 and neighbours.distances of the particles begin to end from the predicted positions,
+// NeighbourList::resizeDistances has to be called first
+void cachePairDistances(const ParticleStore& particles, NeighbourList& neighbours, uint32_t begin, uint32_t end, const SPHSettings& settings);
 
-void calculateDensity(SphParticle* particle, std::vector<SphParticle*> neighbours, const SPHSettings& settings);
+void calculateDensities(ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings, SimdValidationCounts& validation);
+// equation of state pressure
+float getPressureFromDensity(float density, const SPHSettings& settings);
 
-void calculateSedimentDensity(SphParticle* particle, std::vector<SphParticle*> neighbours, const SPHSettings& settings);
+// velocity change of i from the pressure, surface tension and viscosity forces. it is applied by the caller once
+// every particle has been done, so the sweep can run in parallel and every particle sees the same velocities.
+glm::vec3 calculateForces(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings, SimdValidationCounts& validation);
 
-void calculatePressureForce(SphParticle* particle, std::vector<SphParticle*> neighbours, const SPHSettings& settings);
+// velocity change of i from surface tension and viscosity alone, for the iterative pressure solvers
+glm::vec3 calculateNonPressureForces(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings);
 
-void calculateViscosity(SphParticle* particle, std::vector<SphParticle*> neighbours, const SPHSettings& settings);
+// predicted position of i after a step with velocityChange added to its velocity, for the iterative solvers.
+// gravity is added by the integration after the solver, but the prediction has to include it
+void predictPosition(ParticleStore& particles, uint32_t i, glm::vec3 velocityChange, const SPHSettings& settings);
 
-void calculateSufaceTension(SphParticle* particle, std::vector<SphParticle*> neighbours, const SPHSettings& settings);
+// pressure, surface tension and viscosity of particle i with each neighbour j > i, added to the velocity changes
+// of both particles. velocityChanges[j - firstIndex] is the change of particle j, it is only applied by the caller
+// so each thread can accumulate into its own buffer over the particles its pairs reach.
+void calculatePairForces(const ParticleStore& particles, uint32_t i, NeighbourSpan halfNeighbours, glm::vec3* velocityChanges,
+	uint32_t firstIndex, const SPHSettings& settings);
 
 #endif //SPH_SPH_H
\ No newline at end of file
@@ -0,0 +1,161 @@
+#pragma once
+#include <cmath>
+#include <glm/gtx/norm.hpp>
+#include "sph.h"
+
+constexpr float pi = 3.14159265359f;
+
+// Smoothing kernels as policy types, so the sph loops can be instantiated per kernel and the kernel inlined.
+// The normalisation only depends on h, it is precomputed into SPHSettings by updateKernelConstants,
+// the constexpr factor is the part that doesn't depend on h.
+// value takes both the distance and its square, every kernel uses whichever is cheaper.
+// The kernels that can be picked for the density also have derivative, dW/dr, for the pressure solvers.
+
+// 3.5
+// Smoothing kernel
+// https://matthias-research.github.io/pages/publications/sca03.pdf
+// what good about this kernel is that h is already to the power of two, and so is x
+// sqrt is an expensive computation
+struct Poly6Kernel
+{
+	static constexpr float factor = 315.0f / (64 * pi);
+	static float normalisation(float h) { return factor / powf(h, 9); }
+	static float value(const SPHSettings& settings, float r, float r2)
+	{
+		if (r2 > settings.h2) return 0;
+		float x = settings.h2 - r2;
+		return x * x * x * settings.kernels.poly6;
+	}
+	static float derivative(const SPHSettings& settings, float r)
+	{
+		if (r > settings.h) return 0;
+		float x = settings.h2 - r * r;
+		return -6 * r * x * x * settings.kernels.poly6;
+	}
+};
+
+// this kernel is specific to pressure, because the smooth kernels have a vanishing gradient at the center
+// this allows for partciles to be repulsed by eachother.
+// https://matthias-research.github.io/pages/publications/sca03.pdf
+struct SpikyKernel
+{
+	static constexpr float factor = 15.0f / pi;
+	static float normalisation(float h) { return factor / powf(h, 6); }
+	static float value(const SPHSettings& settings, float r, float r2)
+	{
+		if (r > settings.h) return 0;
+		float x = settings.h - r;
+		return x * x * x * settings.kernels.spiky;
+	}
+	static float derivative(const SPHSettings& settings, float r)
+	{
+		if (r > settings.h) return 0;
+		float x = settings.h - r;
+		return -3 * x * x * settings.kernels.spiky;
+	}
+};
+
+// https://github.com/SebLague/Fluid-Sim
+struct Spiky2Kernel
+{
+	static constexpr float factor = 15.0f / (2 * pi);
+	static float normalisation(float h) { return factor / powf(h, 5); }
+	static float value(const SPHSettings& settings, float r, float r2)
+	{
+		if (r > settings.h) return 0;
+		float x = settings.h - r;
+		return x * x * settings.kernels.spiky2;
+	}
+};
+
+// https://matthias-research.github.io/pages/publications/sca03.pdf
+struct ViscosityKernel
+{
+	static constexpr float factor = 15.0f / (2 * pi);
+	static float normalisation(float h) { return factor / powf(h, 3); }
+	static float value(const SPHSettings& settings, float r, float r2)
+	{
+		if (r > settings.h) return 0;
+		float fx = -(r2 * r / (2 * settings.kernels.h3)) + (r2 / settings.h2) + (settings.h / (2 * r)) - 1;
+		return fx * settings.kernels.viscosity;
+	}
+};
+
+// Wendland C2, compact support h. Smoother than spiky, so it stays stable with fewer neighbours.
+// https://doi.org/10.1007/BF02123482
+struct WendlandC2Kernel
+{
+	static constexpr float factor = 21.0f / (2 * pi);
+	static float normalisation(float h) { return factor / powf(h, 3); }
+	static float value(const SPHSettings& settings, float r, float r2)
+	{
+		if (r > settings.h) return 0;
+		float q = r / settings.h;
+		float x = 1 - q;
+		return x * x * x * x * (1 + 4 * q) * settings.kernels.wendlandC2;
+	}
+	static float derivative(const SPHSettings& settings, float r)
+	{
+		if (r > settings.h) return 0;
+		float q = r / settings.h;
+		float x = 1 - q;
+		return -20 * q * x * x * x * settings.kernels.wendlandC2 / settings.h;
+	}
+};
+
+// cubic B-spline (Monaghan), support h
+struct CubicSplineKernel
+{
+	static constexpr float factor = 8.0f / pi;
+	static float normalisation(float h) { return factor / powf(h, 3); }
+	static float value(const SPHSettings& settings, float r, float r2)
+	{
+		if (r > settings.h) return 0;
+		float q = r / settings.h;
+		if (q <= 0.5f)
+			return (6 * (q * q * q - q * q) + 1) * settings.kernels.cubicSpline;
+		float x = 1 - q;
+		return 2 * x * x * x * settings.kernels.cubicSpline;
+	}
+	static float derivative(const SPHSettings& settings, float r)
+	{
+		if (r > settings.h) return 0;
+		float q = r / settings.h;
+		if (q <= 0.5f)
+			return 6 * (3 * q * q - 2 * q) * settings.kernels.cubicSpline / settings.h;
+		float x = 1 - q;
+		return -6 * x * x * settings.kernels.cubicSpline / settings.h;
+	}
+};
+
+// calls f with an instance of the kernel picked in the settings
+template <typename Func>
+void withDensityKernel(const SPHSettings& settings, Func f)
+{
+	switch (settings.densityKernel)
+	{
+	case SPHKernel::POLY6: f(Poly6Kernel()); break;
+	case SPHKernel::WENDLAND_C2: f(WendlandC2Kernel()); break;
+	case SPHKernel::CUBIC_SPLINE: f(CubicSplineKernel()); break;
+	default: f(SpikyKernel()); break;
+	}
+}
+
+// calls f(j, gradient) for every neighbour within h of the predicted position of i, gradient is grad W_ij with
+// respect to i
+template <typename Kernel, typename Func>
+void forEachGradient(Kernel, const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings, Func f)
+{
+	glm::vec3 position = particles.getPredictedPosition(i);
+	for (uint32_t n = 0; n < neighbours.size(); n++)
+	{
+		uint32_t j = neighbours[n];
+		glm::vec3 ab = particles.getPredictedPosition(j) - position;
+		float dist2 = glm::length2(ab);
+		// coincident particles have no direction to push along. clamping the distance instead (like the force sweep)
+		// shrinks the gradient of close pairs, which blows up the dfsph and pbf factors
+		if (dist2 > settings.h2 || dist2 < 1e-12f) continue;
+		float dist = sqrtf(dist2);
+		f(j, -ab / dist * Kernel::derivative(settings, dist));
+	}
+}
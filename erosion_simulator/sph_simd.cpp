@@ -0,0 +1,132 @@
+#include "sph_simd.h"
+#include <algorithm>
+#include <glm/gtx/norm.hpp>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void cpuid(int leaf, int subleaf, int registers[4])
+{
+#ifdef _MSC_VER
+	__cpuidex(registers, leaf, subleaf);
+#else
+	__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+// which register sets the os saves on a context switch
+static uint64_t getEnabledRegisterState()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t low, high;
+	__asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+	return ((uint64_t)high << 32) | low;
+#endif
+}
+
+static SimdLevel findSimdLevel()
+{
+	int registers[4];
+	cpuid(0, 0, registers);
+	int maxLeaf = registers[0];
+
+	cpuid(1, 0, registers);
+	bool sse41 = registers[2] & (1 << 19);
+	bool osxsave = registers[2] & (1 << 27);
+	bool avx = registers[2] & (1 << 28);
+	if (!sse41) return SimdLevel::SCALAR;
+	if (!osxsave || !avx || maxLeaf < 7) return SimdLevel::SSE4;
+
+	uint64_t state = getEnabledRegisterState();
+	// xmm and ymm state
+	if ((state & 0x6) != 0x6) return SimdLevel::SSE4;
+
+	cpuid(7, 0, registers);
+	bool avx2 = registers[1] & (1 << 5);
+	bool avx512f = registers[1] & (1 << 16);
+	if (!avx2) return SimdLevel::SSE4;
+	// opmask and upper zmm state
+	if (!avx512f || (state & 0xe0) != 0xe0) return SimdLevel::AVX2;
+	return SimdLevel::AVX512;
+}
+
+SimdLevel detectSimdLevel()
+{
+	static SimdLevel level = findSimdLevel();
+	return level;
+}
+
+const char* getSimdLevelName(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::SSE4: return "SSE4";
+	case SimdLevel::AVX2: return "AVX2";
+	case SimdLevel::AVX512: return "AVX-512";
+	default: return "Scalar";
+	}
+}
+
+bool simdSupportsKernel(SPHKernel kernel)
+{
+	return kernel == SPHKernel::SPIKY || kernel == SPHKernel::POLY6;
+}
+
+// never above what the cpu has, even if the settings ask for it
+static SimdLevel getUsableSimdLevel(const SPHSettings& settings)
+{
+	if (!simdSupportsKernel(settings.densityKernel)) return SimdLevel::SCALAR;
+	return std::min(settings.simdLevel, detectSimdLevel());
+}
+
+bool calculateDensitiesSimd(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings, float& density, float& sedimentDensity)
+{
+	switch (getUsableSimdLevel(settings))
+	{
+	case SimdLevel::SSE4: calculateDensitiesSSE4(particles, i, neighbours, settings, density, sedimentDensity); return true;
+	case SimdLevel::AVX2: calculateDensitiesAVX2(particles, i, neighbours, settings, density, sedimentDensity); return true;
+	case SimdLevel::AVX512: calculateDensitiesAVX512(particles, i, neighbours, settings, density, sedimentDensity); return true;
+	default: return false;
+	}
+}
+
+bool calculateVelocityChangeSimd(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings, glm::vec3& velocityChange)
+{
+	switch (getUsableSimdLevel(settings))
+	{
+	case SimdLevel::SSE4: velocityChange = calculateVelocityChangeSSE4(particles, i, neighbours, settings); return true;
+	case SimdLevel::AVX2: velocityChange = calculateVelocityChangeAVX2(particles, i, neighbours, settings); return true;
+	case SimdLevel::AVX512: velocityChange = calculateVelocityChangeAVX512(particles, i, neighbours, settings); return true;
+	default: return false;
+	}
+}
+
+bool collideWithTerrainSimd(const TerrainCollision& collision, ParticleStore& particles, uint32_t begin, uint32_t end, const uint8_t* asleep,
+	const SPHSettings& settings)
+{
+	switch (std::min(settings.simdLevel, detectSimdLevel()))
+	{
+	case SimdLevel::SSE4: collideWithTerrainSSE4(collision, particles, begin, end, asleep); return true;
+	case SimdLevel::AVX2: collideWithTerrainAVX2(collision, particles, begin, end, asleep); return true;
+	case SimdLevel::AVX512: collideWithTerrainAVX512(collision, particles, begin, end, asleep); return true;
+	default: return false;
+	}
+}
+
+void validateSimdResult(float simd, float scalar, const SPHSettings& settings, SimdValidationCounts& counts)
+{
+	counts.checked++;
+	if (!(std::abs(simd - scalar) <= settings.simdTolerance * std::max(1.0f, std::abs(scalar))))
+		counts.mismatched++;
+}
+
+void validateSimdResult(glm::vec3 simd, glm::vec3 scalar, const SPHSettings& settings, SimdValidationCounts& counts)
+{
+	counts.checked++;
+	if (!(glm::length(simd - scalar) <= settings.simdTolerance * std::max(1.0f, glm::length(scalar))))
+		counts.mismatched++;
+}
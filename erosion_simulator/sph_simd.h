@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include "sph.h"
+#include "terrain_collision.h"
+
+// SIMD versions of the density and force sweeps, 4 (SSE4), 8 (AVX2) or 16 (AVX-512) neighbours at a time,
+// and of the terrain collision, as many particles at a time.
+// Each instruction set lives in its own translation unit, and is only called once detectSimdLevel
+// found it supported by the cpu and the os.
+
+// highest level the cpu and os support, checked once
+SimdLevel detectSimdLevel();
+const char* getSimdLevelName(SimdLevel level);
+bool simdSupportsKernel(SPHKernel kernel);
+
+// return false when the level is scalar or the density kernel has no simd version, the caller then runs the scalar sweep
+bool calculateDensitiesSimd(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings, float& density, float& sedimentDensity);
+bool calculateVelocityChangeSimd(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings, glm::vec3& velocityChange);
+// doesn't depend on the kernel, only false at the scalar level
+bool collideWithTerrainSimd(const TerrainCollision& collision, ParticleStore& particles, uint32_t begin, uint32_t end, const uint8_t* asleep,
+	const SPHSettings& settings);
+
+// compares a simd result with the scalar one and counts the check and any mismatch into counts
+void validateSimdResult(float simd, float scalar, const SPHSettings& settings, SimdValidationCounts& counts);
+void validateSimdResult(glm::vec3 simd, glm::vec3 scalar, const SPHSettings& settings, SimdValidationCounts& counts);
+
+// per instruction set entry points, defined in sph_simd_<level>.cpp
+void calculateDensitiesSSE4(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings, float& density, float& sedimentDensity);
+void calculateDensitiesAVX2(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings, float& density, float& sedimentDensity);
+void calculateDensitiesAVX512(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings, float& density, float& sedimentDensity);
+glm::vec3 calculateVelocityChangeSSE4(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings);
+glm::vec3 calculateVelocityChangeAVX2(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings);
+glm::vec3 calculateVelocityChangeAVX512(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings);
+void collideWithTerrainSSE4(const TerrainCollision& collision, ParticleStore& particles, uint32_t begin, uint32_t end, const uint8_t* asleep);
+void collideWithTerrainAVX2(const TerrainCollision& collision, ParticleStore& particles, uint32_t begin, uint32_t end, const uint8_t* asleep);
+void collideWithTerrainAVX512(const TerrainCollision& collision, ParticleStore& particles, uint32_t begin, uint32_t end, const uint8_t* asleep);
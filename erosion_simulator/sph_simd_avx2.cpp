@@ -0,0 +1,76 @@
+#include <cstdint>
+#include <immintrin.h>
+#include "sph_simd.h"
+#include "sph_kernels.h"
+
+// msvc emits these intrinsics without /arch, other compilers need the target enabled for the lane code.
+// only after the includes: the inline functions of the headers are shared with the scalar code, a copy of them
+// built for avx2 could be the one the linker keeps
+#ifndef _MSC_VER
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+namespace {
+
+// 8 neighbours per block
+struct Avx2Lane
+{
+	static const int width = 8;
+	typedef __m256 Mask;
+	__m256 v;
+
+	Avx2Lane() {}
+	Avx2Lane(__m256 v) : v(v) {}
+	Avx2Lane(float f) : v(_mm256_set1_ps(f)) {}
+	static Avx2Lane load(const float* p) { return _mm256_loadu_ps(p); }
+	static void store(float* p, Avx2Lane a) { _mm256_storeu_ps(p, a.v); }
+	static Avx2Lane gather(const float* base, const uint32_t* indices)
+	{
+		return _mm256_i32gather_ps(base, _mm256_loadu_si256((const __m256i*)indices), 4);
+	}
+	Avx2Lane operator+(Avx2Lane b) const { return _mm256_add_ps(v, b.v); }
+	Avx2Lane operator-(Avx2Lane b) const { return _mm256_sub_ps(v, b.v); }
+	Avx2Lane operator*(Avx2Lane b) const { return _mm256_mul_ps(v, b.v); }
+	Avx2Lane operator/(Avx2Lane b) const { return _mm256_div_ps(v, b.v); }
+	static Avx2Lane sqrt(Avx2Lane a) { return _mm256_sqrt_ps(a.v); }
+	static Avx2Lane min(Avx2Lane a, Avx2Lane b) { return _mm256_min_ps(a.v, b.v); }
+	static Avx2Lane max(Avx2Lane a, Avx2Lane b) { return _mm256_max_ps(a.v, b.v); }
+	static Avx2Lane truncate(Avx2Lane a) { return _mm256_round_ps(a.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+	static void storeIndices(Avx2Lane a, uint32_t* indices) { _mm256_store_si256((__m256i*)indices, _mm256_cvttps_epi32(a.v)); }
+	static Mask lessEqual(Avx2Lane a, Avx2Lane b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+	static Mask maskAnd(Mask m, Mask n) { return _mm256_and_ps(m, n); }
+	static Mask maskAndNot(Mask m, Mask n) { return _mm256_andnot_ps(n, m); }
+	static Avx2Lane zeroUnless(Mask m, Avx2Lane a) { return _mm256_and_ps(m, a.v); }
+	static Avx2Lane select(Mask m, Avx2Lane a, Avx2Lane b) { return _mm256_blendv_ps(b.v, a.v, m); }
+	float sum() const
+	{
+		__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+		s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+		return _mm_cvtss_f32(s);
+	}
+};
+
+#include "sph_simd_impl.h"
+
+}
+
+void calculateDensitiesAVX2(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings, float& density, float& sedimentDensity)
+{
+	simdCalculateDensitiesForKernel<Avx2Lane>(particles, i, neighbours, settings, density, sedimentDensity);
+}
+
+glm::vec3 calculateVelocityChangeAVX2(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings)
+{
+	return simdCalculateVelocityChangeForKernel<Avx2Lane>(particles, i, neighbours, settings);
+}
+
+void collideWithTerrainAVX2(const TerrainCollision& collision, ParticleStore& particles, uint32_t begin, uint32_t end, const uint8_t* asleep)
+{
+	simdCollideWithTerrainRange<Avx2Lane>(collision, particles, begin, end, asleep);
+}
+
+#ifndef _MSC_VER
+#pragma GCC pop_options
+#endif
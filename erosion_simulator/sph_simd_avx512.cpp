@@ -0,0 +1,70 @@
+#include <cstdint>
+#include <immintrin.h>
+#include "sph_simd.h"
+#include "sph_kernels.h"
+
+// msvc emits these intrinsics without /arch, other compilers need the target enabled for the lane code.
+// only after the includes: the inline functions of the headers are shared with the scalar code, a copy of them
+// built for avx512f could be the one the linker keeps
+#ifndef _MSC_VER
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#endif
+
+namespace {
+
+// 16 neighbours per block
+struct Avx512Lane
+{
+	static const int width = 16;
+	typedef __mmask16 Mask;
+	__m512 v;
+
+	Avx512Lane() {}
+	Avx512Lane(__m512 v) : v(v) {}
+	Avx512Lane(float f) : v(_mm512_set1_ps(f)) {}
+	static Avx512Lane load(const float* p) { return _mm512_loadu_ps(p); }
+	static void store(float* p, Avx512Lane a) { _mm512_storeu_ps(p, a.v); }
+	static Avx512Lane gather(const float* base, const uint32_t* indices)
+	{
+		return _mm512_i32gather_ps(_mm512_loadu_si512(indices), base, 4);
+	}
+	Avx512Lane operator+(Avx512Lane b) const { return _mm512_add_ps(v, b.v); }
+	Avx512Lane operator-(Avx512Lane b) const { return _mm512_sub_ps(v, b.v); }
+	Avx512Lane operator*(Avx512Lane b) const { return _mm512_mul_ps(v, b.v); }
+	Avx512Lane operator/(Avx512Lane b) const { return _mm512_div_ps(v, b.v); }
+	static Avx512Lane sqrt(Avx512Lane a) { return _mm512_sqrt_ps(a.v); }
+	static Avx512Lane min(Avx512Lane a, Avx512Lane b) { return _mm512_min_ps(a.v, b.v); }
+	static Avx512Lane max(Avx512Lane a, Avx512Lane b) { return _mm512_max_ps(a.v, b.v); }
+	static Avx512Lane truncate(Avx512Lane a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+	static void storeIndices(Avx512Lane a, uint32_t* indices) { _mm512_store_si512(indices, _mm512_cvttps_epi32(a.v)); }
+	static Mask lessEqual(Avx512Lane a, Avx512Lane b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ); }
+	static Mask maskAnd(Mask m, Mask n) { return m & n; }
+	static Mask maskAndNot(Mask m, Mask n) { return m & ~n; }
+	static Avx512Lane zeroUnless(Mask m, Avx512Lane a) { return _mm512_maskz_mov_ps(m, a.v); }
+	static Avx512Lane select(Mask m, Avx512Lane a, Avx512Lane b) { return _mm512_mask_blend_ps(m, b.v, a.v); }
+	float sum() const { return _mm512_reduce_add_ps(v); }
+};
+
+#include "sph_simd_impl.h"
+
+}
+
+void calculateDensitiesAVX512(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings, float& density, float& sedimentDensity)
+{
+	simdCalculateDensitiesForKernel<Avx512Lane>(particles, i, neighbours, settings, density, sedimentDensity);
+}
+
+glm::vec3 calculateVelocityChangeAVX512(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings)
+{
+	return simdCalculateVelocityChangeForKernel<Avx512Lane>(particles, i, neighbours, settings);
+}
+
+void collideWithTerrainAVX512(const TerrainCollision& collision, ParticleStore& particles, uint32_t begin, uint32_t end, const uint8_t* asleep)
+{
+	simdCollideWithTerrainRange<Avx512Lane>(collision, particles, begin, end, asleep);
+}
+
+#ifndef _MSC_VER
+#pragma GCC pop_options
+#endif
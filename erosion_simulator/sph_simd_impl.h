@@ -0,0 +1,298 @@
+#pragma once
+#include <cmath>
+
+// Bodies of the simd sweeps, shared by every instruction set. Each sph_simd_<level>.cpp defines its vector type
+// and includes this inside an anonymous namespace, so the instantiations (including the ScalarLane ones) stay
+// local to a file built for one instruction set and the linker can't pick them for another. The vector type has:
+//   width, V(float) broadcast, load(const float*), store(float*), gather(const float*, const uint32_t*), + - * /,
+//   sqrt, min, max, truncate (towards 0), storeIndices(a, uint32_t*) (truncated, to an aligned array),
+//   lessEqual(a, b) giving a Mask, maskAnd(m, n), maskAndNot(m, n) (m and not n), zeroUnless(mask, a),
+//   select(mask, a, b) and sum() over the lanes.
+// zeroUnless has to clear the bits (not multiply), so inf and nan from lanes outside of h don't leak into the sums.
+// The neighbours after the last full block go through ScalarLane, the same body one neighbour wide.
+// terrain_collision.cpp includes this too, for the ScalarLane collision when there's no simd.
+
+struct ScalarLane
+{
+	static const int width = 1;
+	typedef bool Mask;
+	float v;
+
+	ScalarLane() {}
+	ScalarLane(float v) : v(v) {}
+	static ScalarLane load(const float* p) { return *p; }
+	static void store(float* p, ScalarLane a) { *p = a.v; }
+	static ScalarLane gather(const float* base, const uint32_t* indices) { return base[*indices]; }
+	ScalarLane operator+(ScalarLane b) const { return v + b.v; }
+	ScalarLane operator-(ScalarLane b) const { return v - b.v; }
+	ScalarLane operator*(ScalarLane b) const { return v * b.v; }
+	ScalarLane operator/(ScalarLane b) const { return v / b.v; }
+	static ScalarLane sqrt(ScalarLane a) { return sqrtf(a.v); }
+	static ScalarLane min(ScalarLane a, ScalarLane b) { return a.v < b.v ? a.v : b.v; }
+	static ScalarLane max(ScalarLane a, ScalarLane b) { return a.v > b.v ? a.v : b.v; }
+	static ScalarLane truncate(ScalarLane a) { return truncf(a.v); }
+	static void storeIndices(ScalarLane a, uint32_t* indices) { *indices = (uint32_t)a.v; }
+	static Mask lessEqual(ScalarLane a, ScalarLane b) { return a.v <= b.v; }
+	static Mask maskAnd(Mask m, Mask n) { return m && n; }
+	static Mask maskAndNot(Mask m, Mask n) { return m && !n; }
+	static ScalarLane zeroUnless(Mask m, ScalarLane a) { return m ? a.v : 0.0f; }
+	static ScalarLane select(Mask m, ScalarLane a, ScalarLane b) { return m ? a.v : b.v; }
+	float sum() const { return v; }
+};
+
+// same formulas as the policies in sph_kernels.h, the caller masks out r > h
+template <typename V>
+V simdKernelValue(SpikyKernel, const SPHSettings& settings, V r, V r2)
+{
+	V x = V::max(V(settings.h) - r, V(0.0f));
+	return x * x * x * V(settings.kernels.spiky);
+}
+
+template <typename V>
+V simdKernelValue(Poly6Kernel, const SPHSettings& settings, V r, V r2)
+{
+	V x = V::max(V(settings.h2) - r2, V(0.0f));
+	return x * x * x * V(settings.kernels.poly6);
+}
+
+template <typename V>
+V simdKernelValue(Spiky2Kernel, const SPHSettings& settings, V r, V r2)
+{
+	V x = V::max(V(settings.h) - r, V(0.0f));
+	return x * x * V(settings.kernels.spiky2);
+}
+
+template <typename V>
+V simdKernelValue(ViscosityKernel, const SPHSettings& settings, V r, V r2)
+{
+	V fx = V(0.0f) - (r2 * r / V(2 * settings.kernels.h3)) + (r2 / V(settings.h2)) + (V(settings.h) / (V(2.0f) * r)) - V(1.0f);
+	return fx * V(settings.kernels.viscosity);
+}
+
+// squared distance (and distance) from the predicted position of i to the neighbours n to n + width,
+// read from the neighbour list when it has them cached
+template <typename V>
+typename V::Mask simdNeighbourDistances(const ParticleStore& particles, NeighbourSpan neighbours, uint32_t n, glm::vec3 predicted,
+	const SPHSettings& settings, V& abx, V& aby, V& abz, V& r, V& r2)
+{
+	const uint32_t* indices = neighbours.data + n;
+	abx = V::gather(particles.qx.data(), indices) - V(predicted.x);
+	aby = V::gather(particles.qy.data(), indices) - V(predicted.y);
+	abz = V::gather(particles.qz.data(), indices) - V(predicted.z);
+	if (neighbours.distances2)
+	{
+		r2 = V::load(neighbours.distances2 + n);
+		r = V::load(neighbours.distances + n);
+	}
+	else
+	{
+		r2 = abx * abx + aby * aby + abz * abz;
+		r = V::sqrt(r2);
+	}
+	return V::lessEqual(r2, V(settings.h2));
+}
+
+template <typename V, typename Kernel>
+void simdAccumulateDensities(const ParticleStore& particles, NeighbourSpan neighbours, uint32_t n, glm::vec3 predicted,
+	const SPHSettings& settings, V& density, V& sediment)
+{
+	const uint32_t* indices = neighbours.data + n;
+	V abx, aby, abz, r, r2;
+	typename V::Mask inside = simdNeighbourDistances(particles, neighbours, n, predicted, settings, abx, aby, abz, r, r2);
+
+	V w = V::zeroUnless(inside, V::gather(particles.mass.data(), indices) * simdKernelValue(Kernel(), settings, r, r2));
+	density = density + w;
+	sediment = sediment + w * V::gather(particles.sediment.data(), indices);
+}
+
+template <typename V, typename Kernel>
+void simdCalculateDensities(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings,
+	float& density, float& sedimentDensity)
+{
+	glm::vec3 predicted = particles.getPredictedPosition(i);
+	V blockDensity(0.0f), blockSediment(0.0f);
+	ScalarLane tailDensity(0.0f), tailSediment(0.0f);
+
+	uint32_t n = 0;
+	for (; n + V::width <= neighbours.size(); n += V::width)
+		simdAccumulateDensities<V, Kernel>(particles, neighbours, n, predicted, settings, blockDensity, blockSediment);
+	for (; n < neighbours.size(); n++)
+		simdAccumulateDensities<ScalarLane, Kernel>(particles, neighbours, n, predicted, settings, tailDensity, tailSediment);
+
+	// add particle self density
+	float self = particles.mass[i] * Kernel::value(settings, 0, 0);
+	density = blockDensity.sum() + tailDensity.sum() + self;
+	// sediment volume / max sediment volume is sediment / saturation
+	sedimentDensity = (blockSediment.sum() + tailSediment.sum() + self * particles.sediment[i]) / particles.sedimentSaturation;
+}
+
+template <typename V>
+struct SimdForces
+{
+	V pressureX = 0.0f, pressureY = 0.0f, pressureZ = 0.0f;
+	V tensionX = 0.0f, tensionY = 0.0f, tensionZ = 0.0f;
+	V viscosityX = 0.0f, viscosityY = 0.0f, viscosityZ = 0.0f;
+};
+
+template <typename V, typename Kernel>
+void simdAccumulateForces(const ParticleStore& particles, NeighbourSpan neighbours, uint32_t n, glm::vec3 predicted, glm::vec3 velocity,
+	float pressureI, const SPHSettings& settings, SimdForces<V>& forces)
+{
+	const uint32_t* indices = neighbours.data + n;
+	V abx, aby, abz, r, r2;
+	typename V::Mask inside = simdNeighbourDistances(particles, neighbours, n, predicted, settings, abx, aby, abz, r, r2);
+
+	V densityJ = V::gather(particles.density.data(), indices);
+	V massJ = V::gather(particles.mass.data(), indices);
+
+	// pressure, ab points from i to j
+	V pressure = (V(pressureI) + (densityJ - V(settings.restDensity)) * V(settings.pressureMultiplier)) * V(0.5f);
+	V pressureWeight = V::zeroUnless(inside, simdKernelValue(Kernel(), settings, r, r2) * massJ * pressure / densityJ / V::max(V(0.001f), r));
+	forces.pressureX = forces.pressureX - abx * pressureWeight;
+	forces.pressureY = forces.pressureY - aby * pressureWeight;
+	forces.pressureZ = forces.pressureZ - abz * pressureWeight;
+
+	// surface tension pulls i towards j
+	V tensionWeight = V::zeroUnless(inside, simdKernelValue(Spiky2Kernel(), settings, r, r2) * massJ);
+	forces.tensionX = forces.tensionX - abx * tensionWeight;
+	forces.tensionY = forces.tensionY - aby * tensionWeight;
+	forces.tensionZ = forces.tensionZ - abz * tensionWeight;
+
+	// coincident particles are left out like in the scalar sweep, the kernel is infinite there
+	V viscosityWeight = V::zeroUnless(inside, V::zeroUnless(V::lessEqual(V(1e-12f), r2), simdKernelValue(ViscosityKernel(), settings, r, r2) * massJ / densityJ));
+	forces.viscosityX = forces.viscosityX + (V::gather(particles.vx.data(), indices) - V(velocity.x)) * viscosityWeight;
+	forces.viscosityY = forces.viscosityY + (V::gather(particles.vy.data(), indices) - V(velocity.y)) * viscosityWeight;
+	forces.viscosityZ = forces.viscosityZ + (V::gather(particles.vz.data(), indices) - V(velocity.z)) * viscosityWeight;
+}
+
+template <typename V>
+glm::vec3 sumLanes(V x, V y, V z)
+{
+	return glm::vec3(x.sum(), y.sum(), z.sum());
+}
+
+template <typename V, typename Kernel>
+glm::vec3 simdCalculateVelocityChange(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings)
+{
+	glm::vec3 predicted = particles.getPredictedPosition(i);
+	glm::vec3 velocity = particles.getVelocity(i);
+	float pressureI = (particles.density[i] - settings.restDensity) * settings.pressureMultiplier;
+	SimdForces<V> block;
+	SimdForces<ScalarLane> tail;
+
+	uint32_t n = 0;
+	for (; n + V::width <= neighbours.size(); n += V::width)
+		simdAccumulateForces<V, Kernel>(particles, neighbours, n, predicted, velocity, pressureI, settings, block);
+	for (; n < neighbours.size(); n++)
+		simdAccumulateForces<ScalarLane, Kernel>(particles, neighbours, n, predicted, velocity, pressureI, settings, tail);
+
+	glm::vec3 pressureForce = sumLanes(block.pressureX, block.pressureY, block.pressureZ) + sumLanes(tail.pressureX, tail.pressureY, tail.pressureZ);
+	glm::vec3 surfaceTensionForce = sumLanes(block.tensionX, block.tensionY, block.tensionZ) + sumLanes(tail.tensionX, tail.tensionY, tail.tensionZ);
+	glm::vec3 viscosityForce = sumLanes(block.viscosityX, block.viscosityY, block.viscosityZ) + sumLanes(tail.viscosityX, tail.viscosityY, tail.viscosityZ);
+
+	return pressureForce / particles.density[i] * settings.timeStep
+		+ -settings.surfaceTensionMultiplier / particles.mass[i] * surfaceTensionForce * settings.timeStep
+		+ viscosityForce * settings.viscosity * settings.timeStep;
+}
+
+// bilinear height and gradient normal of the terrain under x, z, the same as sampleTerrain.
+// the vertex index goes through a float, exact up to 4096 x 4096 vertices
+template <typename V>
+void simdSampleTerrain(const HeightfieldView& terrain, V x, V z, V& height, V& nx, V& ny, V& nz)
+{
+	// max first, it returns the second operand for nan, so a nan position still reads inside of the heights
+	x = V::max(x + V(terrain.offset.x), V(0.0f));
+	z = V::max(z + V(terrain.offset.y), V(0.0f));
+	V cellX = V::min(V::truncate(x), V((float)(terrain.width - 2)));
+	V cellZ = V::min(V::truncate(z), V((float)(terrain.length - 2)));
+	V weightX = V::min(x - cellX, V(1.0f));
+	V weightZ = V::min(z - cellZ, V(1.0f));
+
+	alignas(64) uint32_t indices[V::width];
+	V::storeIndices(cellZ * V((float)terrain.width) + cellX, indices);
+	V bottomLeft = V::gather(terrain.heights, indices);
+	V bottomRight = V::gather(terrain.heights + 1, indices);
+	V topLeft = V::gather(terrain.heights + terrain.width, indices);
+	V topRight = V::gather(terrain.heights + terrain.width + 1, indices);
+
+	V bottom = bottomLeft + (bottomRight - bottomLeft) * weightX;
+	V top = topLeft + (topRight - topLeft) * weightX;
+	height = bottom + (top - bottom) * weightZ;
+	V slopeX = (bottomRight - bottomLeft) * (V(1.0f) - weightZ) + (topRight - topLeft) * weightZ;
+	V slopeZ = top - bottom;
+	V inverseLength = V(1.0f) / V::sqrt(slopeX * slopeX + slopeZ * slopeZ + V(1.0f));
+	nx = V(0.0f) - slopeX * inverseLength;
+	ny = inverseLength;
+	nz = V(0.0f) - slopeZ * inverseLength;
+}
+
+// the particles i to i + width, see collideWithTerrain
+template <typename V>
+void simdCollideWithTerrain(const TerrainCollision& collision, ParticleStore& particles, uint32_t i, const uint8_t* asleep)
+{
+	alignas(64) float awake[V::width];
+	for (int k = 0; k < V::width; k++)
+		awake[k] = asleep && asleep[i + k] ? 0.0f : 1.0f;
+	typename V::Mask active = V::lessEqual(V(1.0f), V::load(awake));
+
+	V px = V::load(particles.px.data() + i), py = V::load(particles.py.data() + i), pz = V::load(particles.pz.data() + i);
+	V vx = V::load(particles.vx.data() + i), vy = V::load(particles.vy.data() + i), vz = V::load(particles.vz.data() + i);
+	V radius(collision.radius);
+	V height, nx, ny, nz;
+	simdSampleTerrain(collision.terrain, px, pz, height, nx, ny, nz);
+
+	// under the terrain, reflected off the normal. the more head on the hit the more of the vertical velocity is kept
+	typename V::Mask hit = V::maskAnd(active, V::lessEqual(py - radius, height));
+	V normalVelocity = vx * nx + vy * ny + vz * nz;
+	V speed = V::max(V::sqrt(vx * vx + vy * vy + vz * vz), V(1e-12f));
+	V yStrength = V::min(V::max(normalVelocity / speed, V(0.05f)), V(0.95f));
+	V reflected = V(2.0f) * normalVelocity;
+	V hitX = (vx - reflected * nx) * V(0.95f);
+	V hitY = (vy - reflected * ny) * yStrength;
+	V hitZ = (vz - reflected * nz) * V(0.95f);
+
+	// under the map or over it, only when the terrain didn't catch it
+	typename V::Mask floor = V::maskAndNot(V::maskAnd(active, V::lessEqual(py - radius, V(collision.minHeight))), hit);
+	typename V::Mask ceiling = V::maskAndNot(V::maskAndNot(V::maskAndNot(active, V::lessEqual(py + radius, V(collision.ceiling))), hit), floor);
+	V bounceX = vx * V(0.5f);
+	V bounceY = V(0.0f) - vy * V(0.05f);
+	V bounceZ = vz * V(0.5f);
+
+	py = V::select(hit, height + radius, V::select(floor, V(collision.minHeight) + radius, V::select(ceiling, V(collision.ceiling) - radius - V(0.001f), py)));
+	vx = V::select(hit, hitX, V::select(floor, bounceX, V::select(ceiling, bounceX, vx)));
+	vy = V::select(hit, hitY, V::select(floor, bounceY, V::select(ceiling, bounceY, vy)));
+	vz = V::select(hit, hitZ, V::select(floor, bounceZ, V::select(ceiling, bounceZ, vz)));
+	V::store(particles.py.data() + i, py);
+	V::store(particles.vx.data() + i, vx);
+	V::store(particles.vy.data() + i, vy);
+	V::store(particles.vz.data() + i, vz);
+}
+
+template <typename V>
+void simdCollideWithTerrainRange(const TerrainCollision& collision, ParticleStore& particles, uint32_t begin, uint32_t end, const uint8_t* asleep)
+{
+	uint32_t i = begin;
+	for (; i + V::width <= end; i += V::width)
+		simdCollideWithTerrain<V>(collision, particles, i, asleep);
+	for (; i < end; i++)
+		simdCollideWithTerrain<ScalarLane>(collision, particles, i, asleep);
+}
+
+// instantiates the sweeps for every kernel with a simd version, see simdSupportsKernel
+template <typename V>
+void simdCalculateDensitiesForKernel(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings,
+	float& density, float& sedimentDensity)
+{
+	if (settings.densityKernel == SPHKernel::POLY6)
+		simdCalculateDensities<V, Poly6Kernel>(particles, i, neighbours, settings, density, sedimentDensity);
+	else
+		simdCalculateDensities<V, SpikyKernel>(particles, i, neighbours, settings, density, sedimentDensity);
+}
+
+template <typename V>
+glm::vec3 simdCalculateVelocityChangeForKernel(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings)
+{
+	if (settings.densityKernel == SPHKernel::POLY6)
+		return simdCalculateVelocityChange<V, Poly6Kernel>(particles, i, neighbours, settings);
+	return simdCalculateVelocityChange<V, SpikyKernel>(particles, i, neighbours, settings);
+}
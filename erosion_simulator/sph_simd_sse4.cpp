@@ -0,0 +1,75 @@
+#include <cstdint>
+#include <smmintrin.h>
+#include "sph_simd.h"
+#include "sph_kernels.h"
+
+// msvc emits these intrinsics without /arch, other compilers need the target enabled for the lane code.
+// only after the includes: the inline functions of the headers are shared with the scalar code, a copy of them
+// built for sse4.1 could be the one the linker keeps
+#ifndef _MSC_VER
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#endif
+
+namespace {
+
+// 4 neighbours per block
+struct Sse4Lane
+{
+	static const int width = 4;
+	typedef __m128 Mask;
+	__m128 v;
+
+	Sse4Lane() {}
+	Sse4Lane(__m128 v) : v(v) {}
+	Sse4Lane(float f) : v(_mm_set1_ps(f)) {}
+	static Sse4Lane load(const float* p) { return _mm_loadu_ps(p); }
+	static void store(float* p, Sse4Lane a) { _mm_storeu_ps(p, a.v); }
+	static Sse4Lane gather(const float* base, const uint32_t* indices)
+	{
+		return _mm_set_ps(base[indices[3]], base[indices[2]], base[indices[1]], base[indices[0]]);
+	}
+	Sse4Lane operator+(Sse4Lane b) const { return _mm_add_ps(v, b.v); }
+	Sse4Lane operator-(Sse4Lane b) const { return _mm_sub_ps(v, b.v); }
+	Sse4Lane operator*(Sse4Lane b) const { return _mm_mul_ps(v, b.v); }
+	Sse4Lane operator/(Sse4Lane b) const { return _mm_div_ps(v, b.v); }
+	static Sse4Lane sqrt(Sse4Lane a) { return _mm_sqrt_ps(a.v); }
+	static Sse4Lane min(Sse4Lane a, Sse4Lane b) { return _mm_min_ps(a.v, b.v); }
+	static Sse4Lane max(Sse4Lane a, Sse4Lane b) { return _mm_max_ps(a.v, b.v); }
+	static Sse4Lane truncate(Sse4Lane a) { return _mm_round_ps(a.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+	static void storeIndices(Sse4Lane a, uint32_t* indices) { _mm_store_si128((__m128i*)indices, _mm_cvttps_epi32(a.v)); }
+	static Mask lessEqual(Sse4Lane a, Sse4Lane b) { return _mm_cmple_ps(a.v, b.v); }
+	static Mask maskAnd(Mask m, Mask n) { return _mm_and_ps(m, n); }
+	static Mask maskAndNot(Mask m, Mask n) { return _mm_andnot_ps(n, m); }
+	static Sse4Lane zeroUnless(Mask m, Sse4Lane a) { return _mm_and_ps(m, a.v); }
+	static Sse4Lane select(Mask m, Sse4Lane a, Sse4Lane b) { return _mm_blendv_ps(b.v, a.v, m); }
+	float sum() const
+	{
+		__m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+		s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+		return _mm_cvtss_f32(s);
+	}
+};
+
+#include "sph_simd_impl.h"
+
+}
+
+void calculateDensitiesSSE4(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings, float& density, float& sedimentDensity)
+{
+	simdCalculateDensitiesForKernel<Sse4Lane>(particles, i, neighbours, settings, density, sedimentDensity);
+}
+
+glm::vec3 calculateVelocityChangeSSE4(const ParticleStore& particles, uint32_t i, NeighbourSpan neighbours, const SPHSettings& settings)
+{
+	return simdCalculateVelocityChangeForKernel<Sse4Lane>(particles, i, neighbours, settings);
+}
+
+void collideWithTerrainSSE4(const TerrainCollision& collision, ParticleStore& particles, uint32_t begin, uint32_t end, const uint8_t* asleep)
+{
+	simdCollideWithTerrainRange<Sse4Lane>(collision, particles, begin, end, asleep);
+}
+
+#ifndef _MSC_VER
+#pragma GCC pop_options
+#endif
@@ -0,0 +1,40 @@
+#include "terrain_collision.h"
+#include <algorithm>
+#include "sph_simd.h"
+#include "sph_kernels.h"
+
+namespace {
+
+#include "sph_simd_impl.h"
+
+}
+
+// the same as simdSampleTerrain
+float sampleTerrain(const HeightfieldView& terrain, float x, float z, glm::vec3& normal)
+{
+	// 0 first, so nan gives 0 like in the simd version
+	x = std::max(0.0f, x + terrain.offset.x);
+	z = std::max(0.0f, z + terrain.offset.y);
+	int cellX = std::min((int)x, terrain.width - 2);
+	int cellZ = std::min((int)z, terrain.length - 2);
+	float weightX = std::min(x - cellX, 1.0f);
+	float weightZ = std::min(z - cellZ, 1.0f);
+
+	const float* row = terrain.heights + cellZ * terrain.width + cellX;
+	float bottomLeft = row[0], bottomRight = row[1];
+	float topLeft = row[terrain.width], topRight = row[terrain.width + 1];
+
+	float bottom = bottomLeft + (bottomRight - bottomLeft) * weightX;
+	float top = topLeft + (topRight - topLeft) * weightX;
+	float slopeX = (bottomRight - bottomLeft) * (1 - weightZ) + (topRight - topLeft) * weightZ;
+	float slopeZ = top - bottom;
+	normal = glm::normalize(glm::vec3(-slopeX, 1, -slopeZ));
+	return bottom + (top - bottom) * weightZ;
+}
+
+void collideWithTerrain(const TerrainCollision& collision, ParticleStore& particles, uint32_t begin, uint32_t end, const uint8_t* asleep,
+	const SPHSettings& settings)
+{
+	if (!collideWithTerrainSimd(collision, particles, begin, end, asleep, settings))
+		simdCollideWithTerrainRange<ScalarLane>(collision, particles, begin, end, asleep);
+}
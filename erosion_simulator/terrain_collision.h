@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include "glm/glm.hpp"
+#include "sph.h"
+#include "height_map/heightfield.h"
+
+// what the particle collision needs, the terrain plus the bounds of the map
+struct TerrainCollision
+{
+	HeightfieldView terrain;
+	float radius;
+	float minHeight;
+	// particles are kept under this
+	float ceiling;
+};
+
+// bilinear height at world (x, z), and the normal of that surface from its gradient.
+// positions off the terrain take the nearest edge cell
+float sampleTerrain(const HeightfieldView& terrain, float x, float z, glm::vec3& normal);
+
+// Collides the particles begin to end, leaving out the ones marked in asleep (may be null).
+// A particle under the terrain is put back on top of it and its velocity reflected off the normal, the others are
+// kept between minHeight and the ceiling. Runs a block of particles at a time with the simd level of the settings.
+void collideWithTerrain(const TerrainCollision& collision, ParticleStore& particles, uint32_t begin, uint32_t end, const uint8_t* asleep,
+	const SPHSettings& settings);
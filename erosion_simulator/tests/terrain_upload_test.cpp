@@ -0,0 +1,111 @@
+// Checks packTerrainUpload without a gl context. Not part of the vs project, build it on its own from erosion_simulator:
+//   g++ -std=c++20 -I. -I../includes/glm tests/terrain_upload_test.cpp mesh/terrain_upload.cpp height_map/heightfield.cpp
+#include <cstdio>
+#include <set>
+#include <vector>
+#include "mesh/terrain_upload.h"
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	if (!(condition)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #condition); failures++; }
+
+// 3 x 2 tiles, the last column and row of tiles are cut short by the map edge
+static const int width = Heightfield::tileSize * 3;
+static const int length = Heightfield::tileSize + 8;
+
+// the vertices of the tiles and their one vertex border, worked out vertex by vertex
+static std::set<uint32_t> expectedVertices(const Heightfield& heights, const std::vector<uint32_t>& tiles)
+{
+	std::set<uint32_t> vertices;
+	for (uint32_t tile : tiles)
+	{
+		int x0, y0, x1, y1;
+		heights.getTileBounds(tile, x0, y0, x1, y1);
+		for (int y = y0 - 1; y < y1 + 1; y++)
+			for (int x = x0 - 1; x < x1 + 1; x++)
+				if (x >= 0 && x < width && y >= 0 && y < length)
+					vertices.insert(y * width + x);
+	}
+	return vertices;
+}
+
+// packs the tiles and checks what every upload has to hold: the spans are sorted, don't overlap or touch (those would
+// have been merged), no vertex is packed twice and the packed values are the ones of their vertex
+static TerrainUpload checkPacking(const Heightfield& heights, const std::vector<uint32_t>& normals, const std::vector<uint32_t>& tiles)
+{
+	TerrainUpload upload;
+	packTerrainUpload(heights, normals, tiles, upload);
+
+	std::set<uint32_t> packed;
+	uint32_t dataSize = 0;
+	for (size_t s = 0; s < upload.spans.size(); s++)
+	{
+		const TerrainUploadSpan& span = upload.spans[s];
+		if (s > 0)
+		{
+			const TerrainUploadSpan& previous = upload.spans[s - 1];
+			CHECK(span.firstVertex > previous.firstVertex + previous.count);
+		}
+		CHECK(span.dataOffset == dataSize);
+		for (uint32_t i = 0; i < span.count; i++)
+		{
+			uint32_t vertex = span.firstVertex + i;
+			CHECK(packed.insert(vertex).second);
+			CHECK(upload.heights[span.dataOffset + i] == heights[vertex]);
+			CHECK(upload.normals[span.dataOffset + i] == normals[vertex]);
+		}
+		dataSize += span.count;
+	}
+	CHECK(upload.heights.size() == dataSize);
+	CHECK(upload.normals.size() == dataSize);
+	CHECK(packed == expectedVertices(heights, tiles));
+	return upload;
+}
+
+int main()
+{
+	Heightfield heights(width, length);
+	std::vector<uint32_t> normals(width * length);
+	for (uint32_t i = 0; i < heights.size(); i++)
+	{
+		heights[i] = (float)i;
+		normals[i] = i * 7 + 1;
+	}
+
+	// two tiles next to each other: one span per row, over both tiles and the border right of the second
+	{
+		TerrainUpload upload = checkPacking(heights, normals, { 0, 1 });
+		CHECK(upload.spans.size() == Heightfield::tileSize + 1);
+		for (size_t y = 0; y < upload.spans.size(); y++)
+		{
+			CHECK(upload.spans[y].firstVertex == y * width);
+			CHECK(upload.spans[y].count == Heightfield::tileSize * 2 + 1);
+		}
+	}
+
+	// the corner tile at the far edge: the border is only on the sides that aren't the edge of the map
+	{
+		TerrainUpload upload = checkPacking(heights, normals, { 5 });
+		CHECK(upload.spans.size() == length - (Heightfield::tileSize - 1));
+		CHECK(upload.spans.front().firstVertex == (Heightfield::tileSize - 1) * width + Heightfield::tileSize * 2 - 1);
+		CHECK(upload.spans.back().firstVertex + upload.spans.back().count == (uint32_t)(width * length));
+	}
+
+	// tiles on top of each other: the borders overlap by two rows, those are packed once
+	checkPacking(heights, normals, { 0, 3 });
+	checkPacking(heights, normals, { 3, 0, 4 });
+
+	// a whole row of tiles: every row touches the next one, it all becomes a single span
+	{
+		TerrainUpload upload = checkPacking(heights, normals, { 0, 1, 2 });
+		CHECK(upload.spans.size() == 1);
+		CHECK(upload.spans[0].count == (Heightfield::tileSize + 1) * width);
+	}
+
+	// nothing dirty
+	CHECK(checkPacking(heights, normals, {}).spans.empty());
+
+	if (failures == 0) printf("terrain upload: all checks passed\n");
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threadCount)
+	:threadCount(std::max(1, threadCount))
+{
+	startWorkers();
+}
+
+ThreadPool::~ThreadPool()
+{
+	stopWorkers();
+}
+
+void ThreadPool::setThreadCount(int newThreadCount)
+{
+	newThreadCount = std::max(1, newThreadCount);
+	if (newThreadCount == threadCount) return;
+
+	stopWorkers();
+	threadCount = newThreadCount;
+	startWorkers();
+}
+
+void ThreadPool::startWorkers()
+{
+	stopping = false;
+	for (int thread = 1; thread < threadCount; thread++)
+		workers.emplace_back(&ThreadPool::workerLoop, this, thread, jobGeneration);
+}
+
+void ThreadPool::stopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	jobReady.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+	workers.clear();
+}
+
+void ThreadPool::parallelFor(uint32_t count, const std::function<void(uint32_t begin, uint32_t end, int thread)>& body)
+{
+	if (threadCount == 1 || count < (uint32_t)threadCount)
+	{
+		body(0, count, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &body;
+		jobCount = count;
+		workersBusy = threadCount - 1;
+		jobGeneration++;
+	}
+	jobReady.notify_all();
+
+	runRange(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	jobDone.wait(lock, [&] { return workersBusy == 0; });
+	job = nullptr;
+}
+
+void ThreadPool::runRange(int thread)
+{
+	uint32_t begin = (uint32_t)((uint64_t)jobCount * thread / threadCount);
+	uint32_t end = (uint32_t)((uint64_t)jobCount * (thread + 1) / threadCount);
+	(*job)(begin, end, thread);
+}
+
+// seenGeneration is passed in rather than read here, so a job started before the thread got going isn't missed
+void ThreadPool::workerLoop(int thread, uint64_t seenGeneration)
+{
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobReady.wait(lock, [&] { return stopping || jobGeneration != seenGeneration; });
+			if (stopping) return;
+			seenGeneration = jobGeneration;
+		}
+
+		runRange(thread);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			workersBusy--;
+		}
+		jobDone.notify_one();
+	}
+}
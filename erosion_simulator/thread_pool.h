@@ -0,0 +1,45 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+// Fixed set of worker threads for the parallel parts of the simulation step.
+// parallelFor splits [0, count) into one contiguous range per thread, in thread order, so results collected
+// per thread and merged in thread order come out in the same order as a serial loop.
+class ThreadPool
+{
+public:
+	ThreadPool(int threadCount = 1);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// joins the current workers and starts new ones, not to be called during parallelFor
+	void setThreadCount(int threadCount);
+	int getThreadCount() const { return threadCount; }
+
+	// calls body(begin, end, thread) for every thread's range and returns once all are done.
+	// the calling thread runs range 0.
+	void parallelFor(uint32_t count, const std::function<void(uint32_t begin, uint32_t end, int thread)>& body);
+
+private:
+	void startWorkers();
+	void stopWorkers();
+	void workerLoop(int thread, uint64_t seenGeneration);
+	void runRange(int thread);
+
+	int threadCount = 1;
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable jobReady;
+	std::condition_variable jobDone;
+	const std::function<void(uint32_t, uint32_t, int)>* job = nullptr;
+	uint32_t jobCount = 0;
+	uint64_t jobGeneration = 0;
+	int workersBusy = 0;
+	bool stopping = false;
+};
@@ -1,7 +1,10 @@
 #include "window.h"
+#include "sph_simd.h"
 
 #include <iostream>
 #include <string>
+#include <thread>
+#include <algorithm>
 
 Window::Window(int width, int height)
     :width(width), height(height)
@@ -154,7 +157,7 @@ void Window::scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 }
 
 
-void Window::Menu(ErosionModel* model, SPHSettings* settings, SimulationParametersUI* params)
+void Window::Menu(ErosionModel* model, SPHSettings* settings, SimulationParametersUI* params, const SimulationStats* stats)
 {
     if (ImGui::BeginMainMenuBar())
     {
@@ -222,12 +225,12 @@ void Window::Menu(ErosionModel* model, SPHSettings* settings, SimulationParamete
         ImGui::EndMainMenuBar();
     }   
 
-    if (showSimulationParameters) ShowSimulationParameters(model, settings, &showSimulationParameters);
+    if (showSimulationParameters) ShowSimulationParameters(model, settings, stats, &showSimulationParameters);
     //if (showPaintBrushMenu) ShowPaintBrushMenu(model, params, &showPaintBrushMenu);
     //if (showSaveMenu) ShowSaveMenu(params, &showSaveMenu);
 }
 
-void Window::ShowSimulationParameters(ErosionModel* model, SPHSettings* settings, bool *open)
+void Window::ShowSimulationParameters(ErosionModel* model, SPHSettings* settings, const SimulationStats* stats, bool *open)
 {
     if (ImGui::Begin("Simulation Parameters", open))
     {
@@ -247,8 +250,85 @@ void Window::ShowSimulationParameters(ErosionModel* model, SPHSettings* settings
 
         ImGui::SliderFloat("Viscosity", &settings->viscosity, 0.0f, 100.0f, "%.2f");
         ImGui::SliderFloat("Smoothing Radius", &settings->h, 0.001, 1, "%.3f");
+        const char* kernelNames[] = { "Spiky", "Poly6", "Wendland C2", "Cubic Spline" };
+        int kernel = (int)settings->densityKernel;
+        if (ImGui::Combo("Density Kernel", &kernel, kernelNames, IM_ARRAYSIZE(kernelNames)))
+            settings->densityKernel = (SPHKernel)kernel;
         ImGui::SliderFloat("Gravity Constant", &settings->g, -9.8, 9.8, "%.1f");
         ImGui::SliderFloat("Time Step", &settings->timeStep, 0.001, 0.5f, "%.3f");
+        ImGui::Checkbox("Adaptive Time Step", &settings->adaptiveTimeStep);
+        if (settings->adaptiveTimeStep)
+        {
+            ImGui::SliderFloat("CFL Number", &settings->cflNumber, 0.05f, 1.0f, "%.2f");
+            ImGui::SliderFloat("Force Number", &settings->forceNumber, 0.05f, 1.0f, "%.2f");
+        }
+        ImGui::SliderInt("Max Substeps", &settings->maxSubsteps, 1, 64);
+        ImGui::Text("dt: %.5f, %d substeps", stats->timeStep, stats->substeps);
+        ImGui::Text("Max speed: %.3f, max acceleration: %.3f", stats->maxSpeed, stats->maxAcceleration);
+
+        ImGui::Spacing();
+        ImGui::Text("Pressure Solver");
+
+        const char* solverNames[] = { "Equation of State", "PCISPH", "DFSPH", "PBF" };
+        int pressureSolver = (int)settings->pressureSolver;
+        if (ImGui::Combo("Solver", &pressureSolver, solverNames, IM_ARRAYSIZE(solverNames)))
+            settings->pressureSolver = (PressureSolver)pressureSolver;
+        if (settings->pressureSolver == PressureSolver::PBF)
+        {
+            ImGui::SliderInt("PBF Iterations", &settings->pbfIterations, 1, 20);
+            ImGui::SliderFloat("PBF Relaxation", &settings->pbfRelaxation, 0.1f, 1000.0f, "%.1f", ImGuiSliderFlags_Logarithmic);
+            ImGui::Text("Density error: %.4f", stats->densityError);
+        }
+        else if (settings->pressureSolver != PressureSolver::EQUATION_OF_STATE)
+        {
+            ImGui::SliderFloat("Density Tolerance", &settings->pressureTolerance, 0.001f, 0.1f, "%.3f");
+            ImGui::SliderInt("Min Iterations", &settings->minPressureIterations, 1, 10);
+            ImGui::SliderInt("Max Iterations", &settings->maxPressureIterations, 1, 200);
+            ImGui::Text("Iterations: %d, density error: %.4f", stats->pressureIterations, stats->densityError);
+            if (settings->pressureSolver == PressureSolver::DFSPH)
+            {
+                ImGui::SliderFloat("Divergence Tolerance", &settings->divergenceTolerance, 0.001f, 0.1f, "%.3f");
+                ImGui::Text("Divergence iterations: %d, error: %.4f", stats->divergenceIterations, stats->divergenceError);
+            }
+        }
+
+        ImGui::Spacing();
+        ImGui::Text("Neighbour Search");
+
+        ImGui::Checkbox("Verlet Lists", &settings->useVerletLists);
+        ImGui::SliderFloat("Verlet Skin", &settings->verletSkin, 0.001, 0.5f, "%.3f");
+        ImGui::Text("Rebuilds: %d / %d steps", stats->neighbourRebuilds, stats->steps);
+        ImGui::Text("Steps since rebuild: %d", stats->stepsSinceNeighbourRebuild);
+        ImGui::SliderInt("Reorder Interval", &settings->reorderInterval, 0, 500);
+        ImGui::Text("Reorders: %d", stats->particleReorders);
+        ImGui::Checkbox("Half Neighbour Lists", &settings->useHalfNeighbourLists);
+        ImGui::Checkbox("Cache Pair Distances", &settings->cachePairDistances);
+
+        ImGui::Spacing();
+        ImGui::Text("Sleeping");
+        ImGui::Checkbox("Particle Sleeping", &settings->particleSleeping);
+        ImGui::SliderFloat("Sleep Speed", &settings->sleepSpeed, 0.001f, 1.0f, "%.3f");
+        ImGui::SliderFloat("Sleep Density Change", &settings->sleepDensityChange, 0.0001f, 0.01f, "%.4f");
+        ImGui::SliderInt("Sleep Steps", &settings->sleepSteps, 1, 200);
+        ImGui::Text("Active: %u, sleeping: %u", stats->activeParticles, stats->sleepingParticles);
+
+        ImGui::Spacing();
+        ImGui::Text("Threads");
+        ImGui::SliderInt("Thread Count", &settings->threadCount, 1, std::max(1u, std::thread::hardware_concurrency()));
+        ImGui::Text("Step: %.2f ms", stats->stepMilliseconds);
+
+        ImGui::Spacing();
+        ImGui::Text("SIMD");
+
+        // only offer what this cpu supports
+        const char* simdNames[] = { "Scalar", "SSE4", "AVX2", "AVX-512" };
+        int simdLevel = (int)settings->simdLevel;
+        if (ImGui::Combo("Instruction Set", &simdLevel, simdNames, (int)detectSimdLevel() + 1))
+            settings->simdLevel = (SimdLevel)simdLevel;
+        if (!simdSupportsKernel(settings->densityKernel))
+            ImGui::Text("No SIMD version of this kernel, running scalar");
+        ImGui::Checkbox("Validate Against Scalar", &settings->validateSimd);
+        ImGui::Text("Mismatches: %u / %u", stats->simdMismatches, stats->simdValidations);
 
         ImGui::End();
     }
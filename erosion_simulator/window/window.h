@@ -8,6 +8,7 @@
 #include "simulation_parameters_ui.h"
 #include <string>
 #include "sph.h"
+#include "simulation_stats.h"
 
 const int SIMULATION_PARAMETER_WINDOW_WIDTH = 600;
 
@@ -48,7 +49,7 @@ public:
 	double getMouseScrollY() { return mouseScrollY; }
 	
 	
-	void Menu(ErosionModel*, SPHSettings*, SimulationParametersUI*);
+	void Menu(ErosionModel*, SPHSettings*, SimulationParametersUI*, const SimulationStats*);
 	bool showSimulationParameters;
 	bool showPaintBrushMenu;
 	bool showSaveMenu;
@@ -77,7 +78,7 @@ private:
 	double mouseDeltaY = 0;
 
 	
-	void ShowSimulationParameters(ErosionModel* model, SPHSettings* params, bool* open);
+	void ShowSimulationParameters(ErosionModel* model, SPHSettings* params, const SimulationStats* stats, bool* open);
 	void ShowPaintBrushMenu(ErosionModel* model, SimulationParametersUI* params, bool* open);
 	void ShowSaveMenu(SimulationParametersUI* params, bool* open);
 